@@ -1,104 +1,115 @@
 #include "decoder.hpp"
 
 #include <bit>
+#include <cstring>
 #include <format>
 #include <string_view>
 #include <stdexcept>
 
 namespace avi {
     template<typename T>
-    T read(std::istream &file) {
+    T read(io::input &input) {
         T value;
-        file.read(reinterpret_cast<char*>(&value), sizeof(T));
+        std::memcpy(&value, input.read(sizeof(T)).data(), sizeof(T));
         if constexpr (std::endian::native != std::endian::little) {
             value = std::byteswap(value);
         }
         return value;
     }
 
-    void check_signature(std::istream &file, const char* signature) {
-        std::array<char, 4> buffer;
-        file.read(buffer.data(), buffer.size());
-        if (std::string_view(buffer.data(), buffer.size()) != signature) {
+    std::string_view read_signature(io::input &input) {
+        const auto buffer = input.read(4);
+        return std::string_view(reinterpret_cast<const char*>(buffer.data()), buffer.size());
+    }
+
+    void check_signature(io::input &input, const char* signature) {
+        const auto buffer = read_signature(input);
+        if (buffer != signature) {
             throw std::runtime_error(std::format("Invalid signature: {} (expected {})", buffer, signature));
         }
     }
 
-    void skip_junk(std::istream &file) {
+    void skip_junk(io::input &input) {
         while (true) {
-            std::array<char, 4> buffer;
-            file.read(buffer.data(), buffer.size());
-            if (std::string_view(buffer.data(), buffer.size()) == "JUNK") {
-                file.seekg(read<uint32_t>(file), std::ios::cur);
-            } else if (std::string_view(buffer.data(), buffer.size()) == "LIST") {
+            const auto buffer = read_signature(input);
+            if (buffer == "JUNK") {
+                input.skip(read<uint32_t>(input));
+            } else if (buffer == "LIST") {
                 break;
-            } else if (std::string_view(buffer.data(), buffer.size()) == "vprp") {
-                file.seekg(read<uint32_t>(file), std::ios::cur);
+            } else if (buffer == "vprp") {
+                input.skip(read<uint32_t>(input));
             } else {
                 throw std::runtime_error(std::format("Invalid signature: {} (expected LIST, vprp or JUNK)", buffer));
             }
         }
     }
 
-    decoder::decoder(std::istream &file) : _file(file) {
-        check_signature(_file, "RIFF");
-        _file.seekg(4, std::ios::cur);
-        check_signature(_file, "AVI ");
-        check_signature(_file, "LIST");
-        _file.seekg(4, std::ios::cur);
-        check_signature(_file, "hdrl");
-        check_signature(_file, "avih");
-        _file.seekg(4, std::ios::cur);
-        _fps = 1000000 / read<uint32_t>(_file);
-        _file.seekg(12, std::ios::cur);
-        _num_frames = read<uint32_t>(_file);
-        _file.seekg(12, std::ios::cur);
-        _width = read<uint32_t>(_file);
-        _height = read<uint32_t>(_file);
-        _file.seekg(16, std::ios::cur);
-        check_signature(_file, "LIST");
-        _file.seekg(4, std::ios::cur);
-        check_signature(_file, "strl");
-        check_signature(_file, "strh");
-        _file.seekg(4, std::ios::cur);
-        check_signature(_file, "vids");
-        if (read<uint32_t>(_file) != 0) {
-            throw std::runtime_error(std::format("Invalid vids type: {}", read<uint32_t>(_file)));
+    decoder::decoder(std::istream &file) : _owned_input(std::make_unique<io::stream_input>(file)), _input(*_owned_input) {
+        _read_header();
+    }
+
+    decoder::decoder(io::input &input) : _input(input) {
+        _read_header();
+    }
+
+    void decoder::_read_header() {
+        check_signature(_input, "RIFF");
+        _input.skip(4);
+        check_signature(_input, "AVI ");
+        check_signature(_input, "LIST");
+        _input.skip(4);
+        check_signature(_input, "hdrl");
+        check_signature(_input, "avih");
+        _input.skip(4);
+        _fps = 1000000 / read<uint32_t>(_input);
+        _input.skip(12);
+        _num_frames = read<uint32_t>(_input);
+        _input.skip(12);
+        _width = read<uint32_t>(_input);
+        _height = read<uint32_t>(_input);
+        _input.skip(16);
+        check_signature(_input, "LIST");
+        _input.skip(4);
+        check_signature(_input, "strl");
+        check_signature(_input, "strh");
+        _input.skip(4);
+        check_signature(_input, "vids");
+        if (read<uint32_t>(_input) != 0) {
+            throw std::runtime_error(std::format("Invalid vids type: {}", read<uint32_t>(_input)));
         }
-        _file.seekg(48, std::ios::cur);
-        check_signature(_file, "strf");
-        _file.seekg(18, std::ios::cur);
-        const auto bit_per_pixel = read<uint16_t>(_file);
+        _input.skip(48);
+        check_signature(_input, "strf");
+        _input.skip(18);
+        const auto bit_per_pixel = read<uint16_t>(_input);
         if (bit_per_pixel != 24) {
             throw std::runtime_error(std::format("Invalid bit per pixel: {}", bit_per_pixel));
         }
-        const auto compression_type = read<uint32_t>(_file);
+        const auto compression_type = read<uint32_t>(_input);
         if (compression_type != 0) {
             throw std::runtime_error(std::format("Invalid compression type: {}", compression_type)  );
         }
-        _file.seekg(20, std::ios::cur);
-        skip_junk(_file);
-        const auto info_size = read<uint32_t>(_file);
-        check_signature(_file, "INFO");
-        _file.seekg(info_size - 4, std::ios::cur);
-        skip_junk(_file);
-        _file.seekg(4, std::ios::cur);
-        check_signature(_file, "movi");
+        _input.skip(20);
+        skip_junk(_input);
+        const auto info_size = read<uint32_t>(_input);
+        check_signature(_input, "INFO");
+        _input.skip(info_size - 4);
+        skip_junk(_input);
+        _input.skip(4);
+        check_signature(_input, "movi");
 
         if (_width % 4 != 0) {
             throw std::runtime_error(std::format("Width {} is not divisible by 4", _width));
         }
 
-        _frame.resize(_width * _height * 3);
+        _frame_size = _width * _height * 3;
     }
 
-    std::span<uint8_t> decoder::decode_frame() {
-        check_signature(_file, "00dc");
-        const auto frame_size = read<uint32_t>(_file);
-        if (frame_size != _frame.size()) {
-            throw std::runtime_error(std::format("Invalid frame size: {} (expected {})", frame_size, _frame.size()));
+    std::span<const uint8_t> decoder::decode_frame() {
+        check_signature(_input, "00dc");
+        const auto frame_size = read<uint32_t>(_input);
+        if (frame_size != _frame_size) {
+            throw std::runtime_error(std::format("Invalid frame size: {} (expected {})", frame_size, _frame_size));
         }
-        _file.read(reinterpret_cast<char*>(_frame.data()), _frame.size());
-        return _frame;
+        return _input.read(_frame_size);
     }
 }
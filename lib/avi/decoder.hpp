@@ -5,12 +5,16 @@
 #include <istream>
 #include <span>
 #include <vector>
+#include <memory>
+
+#include "../io/input.hpp"
 
 namespace avi {
     class decoder {
     public:
         explicit decoder(std::istream &file);
-        std::span<uint8_t> decode_frame();
+        explicit decoder(io::input &input);
+        std::span<const uint8_t> decode_frame();
 
         size_t height() const { return _height; }
         size_t width() const { return _width; }
@@ -18,12 +22,14 @@ namespace avi {
         size_t fps() const { return _fps; }
 
     private:
-        std::istream &_file;
+        std::unique_ptr<io::input> _owned_input;
+        io::input &_input;
         size_t _height;
         size_t _width;
         size_t _num_frames;
         size_t _fps;
+        size_t _frame_size;
 
-        std::vector<uint8_t> _frame;
+        void _read_header();
     };
 }
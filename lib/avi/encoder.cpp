@@ -1,6 +1,7 @@
 #include "encoder.hpp"
 
 #include <bit>
+#include <algorithm>
 
 template<typename T>
 void write(std::ostream &file, T value) {
@@ -80,16 +81,30 @@ namespace avi {
     }
 
     void encoder::encode_frame(const std::span<uint8_t> &frame) {
-        _file.write("00db", 4);
-        write(_file, _total_frame_size);
-        for (size_t n = 0; n < frame.size() / 3; ++n) {
-            write(_file, frame[n * 3 + 2]);
-            write(_file, frame[n * 3 + 1]);
-            write(_file, frame[n * 3]);
+        convert_frame(frame, _converted);
+        write_frame(_converted);
+    }
+
+    void encoder::convert_frame(std::span<const uint8_t> frame, std::vector<uint8_t> &output) const {
+        const size_t num_pixels = frame.size() / 3;
+        const size_t pad_interval = _width * 3;
+        output.resize(num_pixels * 3 + (num_pixels + pad_interval - 1) / pad_interval * _pad.size());
+
+        auto out = output.begin();
+        for (size_t n = 0; n < num_pixels; ++n) {
+            *out++ = frame[n * 3 + 2];
+            *out++ = frame[n * 3 + 1];
+            *out++ = frame[n * 3];
 
-            if (n % (_width * 3) == 0) {
-                _file.write(reinterpret_cast<const char*>(_pad.data()), _pad.size());
+            if (n % pad_interval == 0) {
+                out = std::copy(_pad.begin(), _pad.end(), out);
             }
         }
     }
+
+    void encoder::write_frame(std::span<const uint8_t> converted) {
+        _file.write("00db", 4);
+        write(_file, _total_frame_size);
+        _file.write(reinterpret_cast<const char*>(converted.data()), converted.size());
+    }
 }
@@ -12,10 +12,15 @@ namespace avi {
         ~encoder();
         void encode_frame(const std::span<uint8_t> &frame);
 
+        // encode_frame split in two, convert_frame does not touch the file and can run on another thread
+        void convert_frame(std::span<const uint8_t> frame, std::vector<uint8_t> &output) const;
+        void write_frame(std::span<const uint8_t> converted);
+
     private:
         std::ostream &_file;
         uint32_t _width;
         std::vector<uint8_t> _pad;
         uint32_t _total_frame_size;
+        std::vector<uint8_t> _converted;
     };
 }
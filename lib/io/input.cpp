@@ -0,0 +1,150 @@
+#include "input.hpp"
+
+#include <format>
+#include <fstream>
+#include <stdexcept>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace io {
+    stream_input::stream_input(std::istream &stream) : _stream(stream) {
+        const auto pos = _stream.tellg();
+        _seekable = pos != std::istream::pos_type(-1);
+        _pos = _seekable ? static_cast<uint64_t>(pos) : 0;
+        _stream.clear();
+    }
+
+    stream_input::stream_input(std::unique_ptr<std::istream> stream) : stream_input(*stream) {
+        _owned_stream = std::move(stream);
+    }
+
+    std::span<const uint8_t> stream_input::read(size_t size) {
+        _buffer.resize(size);
+        if (!_stream.read(reinterpret_cast<char*>(_buffer.data()), size)) {
+            throw std::runtime_error("Unexpected end of file");
+        }
+        _pos += size;
+        return _buffer;
+    }
+
+    void stream_input::skip(size_t size) {
+        if (_seekable) {
+            _stream.seekg(size, std::ios::cur);
+        } else {
+            _stream.ignore(size);
+        }
+        if (!_stream || (!_seekable && static_cast<size_t>(_stream.gcount()) != size)) {
+            throw std::runtime_error("Unexpected end of file");
+        }
+        _pos += size;
+    }
+
+    void stream_input::seek(uint64_t offset) {
+        if (!_seekable) {
+            throw std::runtime_error("Input is not seekable");
+        }
+
+        _stream.clear();
+        if (!_stream.seekg(offset)) {
+            throw std::runtime_error(std::format("Could not seek to {}", offset));
+        }
+        _pos = offset;
+    }
+
+#ifdef _WIN32
+    mapped_input::mapped_input(const std::filesystem::path &path) {
+        const auto file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (file == INVALID_HANDLE_VALUE) {
+            throw std::runtime_error(std::format("Could not open {}", path.string()));
+        }
+
+        LARGE_INTEGER size;
+        const auto mapping = GetFileSizeEx(file, &size) && size.QuadPart > 0 ? CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr) : nullptr;
+        CloseHandle(file);
+        if (mapping == nullptr) {
+            throw std::runtime_error(std::format("Could not map {}", path.string()));
+        }
+
+        _data = static_cast<const uint8_t*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+        CloseHandle(mapping);
+        if (_data == nullptr) {
+            throw std::runtime_error(std::format("Could not map {}", path.string()));
+        }
+        _size = static_cast<size_t>(size.QuadPart);
+    }
+
+    mapped_input::~mapped_input() {
+        UnmapViewOfFile(_data);
+    }
+#else
+    mapped_input::mapped_input(const std::filesystem::path &path) {
+        const int file = ::open(path.c_str(), O_RDONLY);
+        if (file < 0) {
+            throw std::runtime_error(std::format("Could not open {}", path.string()));
+        }
+
+        struct stat info;
+        void *data = MAP_FAILED;
+        if (fstat(file, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0) {
+            data = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+        }
+        ::close(file);
+        if (data == MAP_FAILED) {
+            throw std::runtime_error(std::format("Could not map {}", path.string()));
+        }
+
+        madvise(data, info.st_size, MADV_SEQUENTIAL);
+        _data = static_cast<const uint8_t*>(data);
+        _size = info.st_size;
+    }
+
+    mapped_input::~mapped_input() {
+        munmap(const_cast<uint8_t*>(_data), _size);
+    }
+#endif
+
+    std::span<const uint8_t> mapped_input::read(size_t size) {
+        if (size > _size - _pos) {
+            throw std::runtime_error("Unexpected end of file");
+        }
+        const auto result = std::span(_data + _pos, size);
+        _pos += size;
+        return result;
+    }
+
+    void mapped_input::skip(size_t size) {
+        if (size > _size - _pos) {
+            throw std::runtime_error("Unexpected end of file");
+        }
+        _pos += size;
+    }
+
+    void mapped_input::seek(uint64_t offset) {
+        if (offset > _size) {
+            throw std::runtime_error(std::format("Could not seek to {}", offset));
+        }
+        _pos = offset;
+    }
+
+    std::unique_ptr<input> open(const std::filesystem::path &path) {
+        try {
+            return std::make_unique<mapped_input>(path);
+        } catch (const std::runtime_error &) {
+            auto stream = std::make_unique<std::ifstream>(path, std::ios::binary);
+            if (!*stream) {
+                throw std::runtime_error(std::format("Could not open {}", path.string()));
+            }
+            return std::make_unique<stream_input>(std::move(stream));
+        }
+    }
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <istream>
+#include <memory>
+#include <span>
+#include <vector>
+#include <filesystem>
+
+namespace io {
+    // byte source shared by the decoders, read() hands out the bytes instead of copying them into the caller
+    class input {
+    public:
+        virtual ~input() = default;
+
+        // the returned bytes stay valid until the next call, or as long as the input lives if persistent()
+        virtual std::span<const uint8_t> read(size_t size) = 0;
+        virtual void skip(size_t size) = 0;
+        virtual uint64_t tell() const = 0;
+        virtual void seek(uint64_t offset) = 0;
+
+        virtual bool persistent() const = 0;
+        virtual bool seekable() const = 0;
+    };
+
+    class stream_input : public input {
+    public:
+        explicit stream_input(std::istream &stream);
+        explicit stream_input(std::unique_ptr<std::istream> stream);
+
+        std::span<const uint8_t> read(size_t size) override;
+        void skip(size_t size) override;
+        uint64_t tell() const override { return _pos; }
+        void seek(uint64_t offset) override;
+
+        bool persistent() const override { return false; }
+        bool seekable() const override { return _seekable; }
+
+    private:
+        std::unique_ptr<std::istream> _owned_stream;
+        std::istream &_stream;
+        std::vector<uint8_t> _buffer;
+        // pipes and sockets can only be read forward, skip() then reads and discards
+        bool _seekable;
+        uint64_t _pos;
+    };
+
+    // whole file mapped into memory, reads are views into the mapping
+    class mapped_input : public input {
+    public:
+        explicit mapped_input(const std::filesystem::path &path);
+        ~mapped_input() override;
+
+        mapped_input(const mapped_input &) = delete;
+        mapped_input &operator=(const mapped_input &) = delete;
+
+        std::span<const uint8_t> read(size_t size) override;
+        void skip(size_t size) override;
+        uint64_t tell() const override { return _pos; }
+        void seek(uint64_t offset) override;
+
+        bool persistent() const override { return true; }
+        bool seekable() const override { return true; }
+
+    private:
+        const uint8_t *_data = nullptr;
+        size_t _size = 0;
+        size_t _pos = 0;
+    };
+
+    // maps regular files and falls back to reading through a stream where mapping is not possible
+    std::unique_ptr<input> open(const std::filesystem::path &path);
+}
@@ -5,8 +5,20 @@
 #include <algorithm>
 #include <format>
 #include <string_view>
+#include <utility>
 #include <stdexcept>
 
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define SMK_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define SMK_TARGET(isa)
+#else
+#define SMK_TARGET(isa) __attribute__((target(isa)))
+#endif
+#endif
+
 namespace smk {
     constexpr static uint16_t HUFF8_BRANCH = 0x8000;
     constexpr static uint16_t HUFF8_LEAF_MASK = 0x7FFF;
@@ -14,17 +26,83 @@ namespace smk {
     constexpr static uint32_t HUFF16_BRANCH = 0x80000000;
     constexpr static uint32_t HUFF16_LEAF_MASK = 0x3FFFFFFF;
     constexpr static uint32_t HUFF16_CACHE = 0x40000000;
+    // every 16-bit value plus the three cache escapes as leaves
+    constexpr static size_t HUFF16_MAX_NODES = 2 * (0x10000 + 3) - 1;
+
+    // lookup table entries: either a leaf with its code length or a link to a subtable for longer codes
+    constexpr static uint8_t HUFF16_TABLE_BITS = 11;
+    constexpr static uint32_t HUFF16_TABLE_LINK = 0x80000000;
+    constexpr static uint32_t HUFF16_TABLE_CACHE = 0x00010000;
+    constexpr static uint32_t HUFF16_TABLE_VALUE_MASK = 0x0000FFFF;
+    constexpr static uint32_t HUFF16_TABLE_OFFSET_MASK = 0x00FFFFFF;
 
     template<typename T>
-    T read(std::istream &file) {
+    T read(io::input &input) {
         T value;
-        file.read(reinterpret_cast<char*>(&value), sizeof(T));
+        std::memcpy(&value, input.read(sizeof(T)).data(), sizeof(T));
         if constexpr (std::endian::native != std::endian::little) {
             value = std::byteswap(value);
         }
         return value;
     }
 
+    // audio chunks follow the palette, one for every track flagged in the frame type, each led by its size
+    // including the size field, returns where the video data starts
+    static size_t read_audio_chunks(std::span<const uint8_t> data, size_t offset, uint8_t type, std::array<std::span<const uint8_t>, 7> &chunks) {
+        for (size_t n = 0; n < chunks.size(); ++n) {
+            chunks[n] = {};
+            if (!(type & (0x02 << n))) {
+                continue;
+            }
+
+            if (data.size() - offset < sizeof(uint32_t)) {
+                throw std::runtime_error("Audio exceeds frame");
+            }
+            uint32_t size;
+            std::memcpy(&size, data.data() + offset, sizeof(size));
+            if constexpr (std::endian::native != std::endian::little) {
+                size = std::byteswap(size);
+            }
+            if (size < sizeof(uint32_t) || size > data.size() - offset) {
+                throw std::runtime_error("Audio exceeds frame");
+            }
+
+            chunks[n] = data.subspan(offset + sizeof(uint32_t), size - sizeof(uint32_t));
+            offset += size;
+        }
+
+        return offset;
+    }
+
+    constexpr static uint32_t AUDIO_COMPRESSED = 0x80000000;
+    constexpr static uint32_t AUDIO_PRESENT = 0x40000000;
+    constexpr static uint32_t AUDIO_16BIT = 0x20000000;
+    constexpr static uint32_t AUDIO_STEREO = 0x10000000;
+    constexpr static uint32_t AUDIO_BINK = 0x08000000;
+    constexpr static uint32_t AUDIO_DCT = 0x04000000;
+    constexpr static uint32_t AUDIO_RATE_MASK = 0x00FFFFFF;
+
+    constexpr static std::array<size_t, 64> sizetable = {
+        1,	2,	3,	4,	5,	6,	7,	8,
+        9,	10,	11,	12,	13,	14,	15,	16,
+        17,	18,	19,	20,	21,	22,	23,	24,
+        25,	26,	27,	28,	29,	30,	31,	32,
+        33,	34,	35,	36,	37,	38,	39,	40,
+        41,	42,	43,	44,	45,	46,	47,	48,
+        49,	50,	51,	52,	53,	54,	55,	56,
+        57,	58,	59,	128, 256, 512, 1024, 2048
+    };
+
+    // full block layouts, version 4 picks one per chain
+    constexpr static uint8_t FULL_MODE_ROWS = 0;
+    constexpr static uint8_t FULL_MODE_DOUBLED = 1;
+    constexpr static uint8_t FULL_MODE_HALVES = 2;
+    constexpr static std::array<size_t, 3> full_symbols = { 8, 2, 4 };
+
+    constexpr static uint32_t FLAG_RING_FRAME = 0x01;
+    constexpr static uint32_t FLAG_Y_INTERLACE = 0x02;
+    constexpr static uint32_t FLAG_Y_DOUBLE = 0x04;
+
     enum class frame_type : uint8_t {
         mono = 0,
         full = 1,
@@ -32,214 +110,771 @@ namespace smk {
         solid = 3,
     };
 
-    decoder::decoder(std::istream &file) : _file(file) {
-        std::array<char, 4> signature;
-        file.read(signature.data(), signature.size());
-        if (std::string_view(signature.data(), signature.size()) != "SMK2") {
-            throw std::runtime_error(std::format("Invalid SMK signature: {}", signature));
+    using surface_palette = std::array<std::array<uint8_t, 4>, 256>;
+
+    // a 4x4 block of palette indices, bit n * 4 + m of the map selects color1 for row n, column m
+    static void mono_block_scalar(uint8_t *t, size_t stride, uint16_t map, uint8_t color1, uint8_t color2) {
+        constexpr auto masks = [] {
+            std::array<uint32_t, 16> masks{};
+            for (size_t n = 0; n < masks.size(); ++n) {
+                for (size_t m = 0; m < 4; ++m) {
+                    if (n & (1 << m)) {
+                        masks[n] |= 0xFFu << (std::endian::native == std::endian::little ? m * 8 : (3 - m) * 8);
+                    }
+                }
+            }
+            return masks;
+        }();
+
+        const uint32_t fill1 = color1 * 0x01010101u;
+        const uint32_t fill2 = color2 * 0x01010101u;
+        for (size_t n = 0; n < 4; ++n) {
+            const uint32_t mask = masks[(map >> (n * 4)) & 0x0F];
+            const uint32_t row = (fill1 & mask) | (fill2 & ~mask);
+            std::memcpy(t, &row, sizeof(row));
+            t += stride;
         }
+    }
+
+    static void expand_row4_scalar(const uint8_t *indices, size_t count, const surface_palette &palette, uint8_t *data) {
+        for (size_t n = 0; n < count; ++n) {
+            std::memcpy(data + n * 4, palette[indices[n]].data(), 4);
+        }
+    }
+
+#ifdef SMK_X86
+    SMK_TARGET("sse2")
+    static void mono_block_sse2(uint8_t *t, size_t stride, uint16_t map, uint8_t color1, uint8_t color2) {
+        // low map byte into lanes 0-7 (rows 0 and 1), high byte into lanes 8-15, each lane then tests its own bit
+        __m128i bits = _mm_cvtsi32_si128(map);
+        bits = _mm_unpacklo_epi8(bits, bits);
+        bits = _mm_unpacklo_epi16(bits, bits);
+        bits = _mm_unpacklo_epi32(bits, bits);
+
+        const __m128i select = _mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128);
+        const __m128i mask = _mm_cmpeq_epi8(_mm_and_si128(bits, select), select);
+        __m128i block = _mm_or_si128(_mm_and_si128(mask, _mm_set1_epi8(static_cast<char>(color1))), _mm_andnot_si128(mask, _mm_set1_epi8(static_cast<char>(color2))));
+
+        for (size_t n = 0; n < 4; ++n) {
+            const int32_t row = _mm_cvtsi128_si32(block);
+            std::memcpy(t, &row, sizeof(row));
+            block = _mm_srli_si128(block, 4);
+            t += stride;
+        }
+    }
+
+    SMK_TARGET("avx2")
+    static void expand_row4_avx2(const uint8_t *indices, size_t count, const surface_palette &palette, uint8_t *data) {
+        const auto *colors = reinterpret_cast<const int*>(palette.data());
+        size_t n = 0;
+        for (; n + 8 <= count; n += 8) {
+            const __m256i lanes = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(indices + n)));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(data + n * 4), _mm256_i32gather_epi32(colors, lanes, 4));
+        }
+        expand_row4_scalar(indices + n, count - n, palette, data + n * 4);
+    }
+
+    static bool cpu_supports_sse2() {
+#ifdef _MSC_VER
+        int info[4];
+        __cpuid(info, 1);
+        return (info[3] & (1 << 26)) != 0;
+#else
+        return __builtin_cpu_supports("sse2");
+#endif
+    }
+
+    static bool cpu_supports_avx2() {
+#ifdef _MSC_VER
+        int info[4];
+        __cpuid(info, 0);
+        if (info[0] < 7) {
+            return false;
+        }
+        // AVX needs OSXSAVE and the OS saving the ymm registers as well
+        __cpuid(info, 1);
+        if (!(info[2] & (1 << 27)) || !(info[2] & (1 << 28)) || (_xgetbv(0) & 0x06) != 0x06) {
+            return false;
+        }
+        __cpuidex(info, 7, 0);
+        return (info[1] & (1 << 5)) != 0;
+#else
+        return __builtin_cpu_supports("avx2");
+#endif
+    }
+#endif
+
+    struct block_kernels {
+        void (*mono)(uint8_t *t, size_t stride, uint16_t map, uint8_t color1, uint8_t color2);
+        void (*expand_row4)(const uint8_t *indices, size_t count, const surface_palette &palette, uint8_t *data);
+    };
+
+    // picked once per process from what the CPU supports
+    static const block_kernels &select_kernels(bool simd) {
+        static const block_kernels scalar = { mono_block_scalar, expand_row4_scalar };
+        static const block_kernels best = [] {
+            block_kernels kernels = scalar;
+#ifdef SMK_X86
+            if (cpu_supports_sse2()) {
+                kernels.mono = mono_block_sse2;
+            }
+            if (cpu_supports_avx2()) {
+                kernels.expand_row4 = expand_row4_avx2;
+            }
+#endif
+            return kernels;
+        }();
+
+        return simd ? best : scalar;
+    }
 
-        _width = read<uint32_t>(_file);
-        _height = read<uint32_t>(_file);
-        _num_frames = read<uint32_t>(_file);
-        _framerate = read<int32_t>(_file);
+    decoder::decoder(std::istream &file) : decoder(file, options{}) {}
+
+    decoder::decoder(std::istream &file, const options &options) : decoder(std::make_unique<io::stream_input>(file), options) {}
+
+    decoder::decoder(io::input &input) : decoder(input, options{}) {}
+
+    decoder::decoder(io::input &input, const options &options) : _input(input), _simd(options.simd), _threads(std::max<size_t>(options.threads, 1)) {
+        _read_header();
+    }
+
+    decoder::decoder(std::unique_ptr<io::input> input, const options &options) : _owned_input(std::move(input)), _input(*_owned_input), _simd(options.simd), _threads(std::max<size_t>(options.threads, 1)) {
+        _read_header();
+    }
+
+    void decoder::_read_header() {
+        const auto signature = _input.read(4);
+        const std::string_view version(reinterpret_cast<const char*>(signature.data()), signature.size());
+        if (version != "SMK2" && version != "SMK4") {
+            throw std::runtime_error(std::format("Invalid SMK signature: {}", version));
+        }
+        _version4 = version == "SMK4";
+
+        _width = read<uint32_t>(_input);
+        _height = read<uint32_t>(_input);
+        _num_frames = read<uint32_t>(_input);
+        _framerate = read<int32_t>(_input);
         if (_framerate > 0) {
+            // milliseconds per frame
+            _frame_duration = std::chrono::milliseconds(_framerate);
             _framerate = 1000 / _framerate;
         } else if (_framerate < 0) {
+            // tens of microseconds per frame
+            _frame_duration = std::chrono::microseconds(-static_cast<int64_t>(_framerate) * 10);
             _framerate = 100000 / -_framerate;
         } else {
+            _frame_duration = std::chrono::milliseconds(100);
             _framerate = 10;
         }
 
-        auto flags = read<uint32_t>(_file);
-        if (flags != 0) {
+        auto flags = read<uint32_t>(_input);
+        if (flags & ~(FLAG_RING_FRAME | FLAG_Y_INTERLACE | FLAG_Y_DOUBLE)) {
             throw std::runtime_error(std::format("Unsupported flags: {}", flags));
         }
+        // the ring frame follows the last one and leads back into the first when looping, it is stored like any other
+        if (flags & FLAG_RING_FRAME) {
+            ++_num_frames;
+        }
+        _y_interlaced = flags & FLAG_Y_INTERLACE;
+        _y_doubled = !_y_interlaced && (flags & FLAG_Y_DOUBLE);
 
-        _file.seekg(28, std::ios::cur);
-        auto trees_size = read<uint32_t>(_file);
-        _file.seekg(48, std::ios::cur);
-
-        _frame_sizes.resize(_num_frames);
-        _file.read(reinterpret_cast<char*>(_frame_sizes.data()), _frame_sizes.size() * sizeof(decltype(_frame_sizes)::value_type));
-
-        _frame_types.resize(_num_frames);
-        _file.read(reinterpret_cast<char*>(_frame_types.data()), _frame_types.size());
+        std::array<uint32_t, max_audio_tracks> audio_sizes;
+        for (auto &size : audio_sizes) {
+            size = read<uint32_t>(_input);
+        }
 
-        for (auto type : _frame_types) {
-            if ((type & ~0x01) != 0) {
-                throw std::runtime_error("Audio is not supported");
+        auto trees_size = read<uint32_t>(_input);
+        const auto mmap_size = read<uint32_t>(_input);
+        const auto mclr_size = read<uint32_t>(_input);
+        const auto full_size = read<uint32_t>(_input);
+        const auto type_size = read<uint32_t>(_input);
+
+        for (size_t n = 0; n < max_audio_tracks; ++n) {
+            const auto rate = read<uint32_t>(_input);
+            auto &track = _audio_tracks[n];
+            track = {};
+            if (!(rate & AUDIO_PRESENT)) {
+                continue;
             }
+            if (rate & (AUDIO_BINK | AUDIO_DCT)) {
+                throw std::runtime_error(std::format("Unsupported audio compression on track {}", n));
+            }
+
+            track.rate = rate & AUDIO_RATE_MASK;
+            track.channels = rate & AUDIO_STEREO ? 2 : 1;
+            track.bits = rate & AUDIO_16BIT ? 16 : 8;
+            track.compressed = rate & AUDIO_COMPRESSED;
+            track.max_size = audio_sizes[n];
         }
+        _input.skip(4);
 
-        const auto end_of_trees = _file.tellg() + static_cast<std::istream::pos_type>(trees_size);
+        _frame_sizes.resize(_num_frames);
+        std::memcpy(_frame_sizes.data(), _input.read(_frame_sizes.size() * sizeof(decltype(_frame_sizes)::value_type)).data(), _frame_sizes.size() * sizeof(decltype(_frame_sizes)::value_type));
 
-        _init_bitstream();
-        _mmap = _build_hoff16();
-        _mclr = _build_hoff16();
-        _full = _build_hoff16();
-        _type = _build_hoff16();
+        const auto frame_types = _input.read(_num_frames);
+        _frame_types.assign(frame_types.begin(), frame_types.end());
 
-        _file.seekg(end_of_trees);
+        _read_buffer(trees_size);
+        _init_bitstream();
+        _mmap = _build_hoff16(mmap_size);
+        _mclr = _build_hoff16(mclr_size);
+        _full = _build_hoff16(full_size);
+        _type = _build_hoff16(type_size);
 
         if (_width % 4 != 0 || _height % 4 != 0) {
             throw std::runtime_error("Width and height must be divisible by 4");
         }
 
+        _frame_offsets.resize(_num_frames);
+        uint64_t offset = _input.tell();
+        for (size_t n = 0; n < _num_frames; ++n) {
+            _frame_offsets[n] = offset;
+            offset += _frame_sizes[n] & ~0x03;
+        }
+
         std::ranges::fill(_palette, palette::value_type{0x00, 0x00, 0x00});
         _current_frame = 0;
-        _frame_data.resize(_width * _height * 3);
-        std::ranges::fill(_frame_data, 0);
+        _index_data.resize(_width * _height);
+        std::ranges::fill(_index_data, 0);
+        _changed_blocks.assign((_width / 4) * (_height / 4), 1);
+        _preview_indices.assign((_width / 4) * (_height / 4), 0);
     }
 
-    std::span<uint8_t> decoder::decode_frame() {
-        const auto end_of_frame = _file.tellg() + static_cast<std::istream::pos_type>(_frame_sizes[_current_frame] & ~0x03); // 1st bottom bit indicates keyframe, 2nd bottom bit is reversed
+    void decoder::seek(size_t frame) {
+        if (frame >= _num_frames) {
+            throw std::runtime_error(std::format("Frame {} out of range", frame));
+        }
 
-        if (_frame_types[_current_frame] & 0x01) {
-            _read_palette();
+        if (!_input.seekable()) {
+            throw std::runtime_error("Input is not seekable");
         }
 
-        constexpr size_t sizetable[64] = {
-            1,	2,	3,	4,	5,	6,	7,	8,
-            9,	10,	11,	12,	13,	14,	15,	16,
-            17,	18,	19,	20,	21,	22,	23,	24,
-            25,	26,	27,	28,	29,	30,	31,	32,
-            33,	34,	35,	36,	37,	38,	39,	40,
-            41,	42,	43,	44,	45,	46,	47,	48,
-            49,	50,	51,	52,	53,	54,	55,	56,
-            57,	58,	59,	128, 256, 512, 1024, 2048
-        };
+        _pending.clear();
 
-        std::ranges::fill(_mmap.cache, 0);
-        std::ranges::fill(_mclr.cache, 0);
-        std::ranges::fill(_full.cache, 0);
-        std::ranges::fill(_type.cache, 0);
+        size_t start = frame;
+        while (start > 0 && !(_frame_sizes[start] & 0x01)) {
+            --start;
+        }
 
-        _init_bitstream();
+        // palette chunks can copy from the previous palette, so every one before the start has to be replayed
+        std::ranges::fill(_palette, palette::value_type{0x00, 0x00, 0x00});
+        for (size_t n = 0; n < start; ++n) {
+            if (_frame_types[n] & 0x01) {
+                _input.seek(_frame_offsets[n]);
+                _read_buffer(_frame_sizes[n] & ~0x03);
+                _read_palette();
+            }
+        }
 
-        uint8_t *t = _frame_data.data();
-        size_t row = 0, col = 0;
-        while (row < _height) {
-            const auto block = _lookup_hoff16(_type);
+        _input.seek(_frame_offsets[start]);
+        _audio_chunks = {};
+        _current_frame = start;
+        _next_frame = start;
+        std::ranges::fill(_index_data, 0);
+        std::ranges::fill(_preview_indices, 0);
 
-            const auto type = block & 0x0003;
-            const auto blocklen = (block & 0x00FC) >> 2;
-            const auto typedata = (block & 0xFF00) >> 8;
+        while (_current_frame < frame) {
+            _decode_indices();
+        }
 
-            for (size_t n = 0; n < sizetable[blocklen] && row < _height; ++n) {
-                auto skip = (row * _width * 3) + col * 3;
+        _palette_reset = true;
+    }
+
+    template<bool Preview, typename F, typename M>
+    void decoder::_decode_blocks(const F &read, const M &read_mode) {
+        const auto &kernels = select_kernels(_simd);
+        const size_t blocks_wide = _width / 4;
+        const size_t blocks_high = _height / 4;
+        if (blocks_wide == 0 || blocks_high == 0) {
+            return;
+        }
+
+        size_t bx = 0, by = 0;
+        // chains run in row-major block order, so the blocks they cover are contiguous in _changed_blocks
+        const auto mark = [&](size_t count, uint8_t changed) {
+            const size_t index = by * blocks_wide + bx;
+            std::fill_n(_changed_blocks.data() + index, std::min(count, _changed_blocks.size() - index), changed);
+        };
+        const auto advance = [&](size_t count) {
+            bx += count;
+            by += bx / blocks_wide;
+            bx %= blocks_wide;
+        };
+
+        while (by < blocks_high) {
+            const auto block = read(_type);
 
-                switch (static_cast<frame_type>(type)) {
-                    case frame_type::mono: {
-                        const auto colors = _lookup_hoff16(_mclr);
-                        const auto map = _lookup_hoff16(_mmap);
+            const auto type = block & 0x0003;
+            const auto blocklen = (block & 0x00FC) >> 2;
+            const uint8_t typedata = (block & 0xFF00) >> 8;
+            size_t count = sizetable[blocklen];
+
+            switch (static_cast<frame_type>(type)) {
+                case frame_type::mono: {
+                    for (; count > 0 && by < blocks_high; --count) {
+                        const auto colors = read(_mclr);
+                        const auto map = read(_mmap);
+
+                        const uint8_t color1 = (colors & 0xFF00) >> 8;
+                        const uint8_t color2 = colors & 0xFF;
+                        if constexpr (Preview) {
+                            _preview_indices[by * blocks_wide + bx] = std::popcount(map) >= 8 ? color1 : color2;
+                        } else {
+                            kernels.mono(_index_data.data() + by * 4 * _width + bx * 4, _width, map, color1, color2);
+                        }
+                        mark(1, 1);
+                        advance(1);
+                    }
 
-                        const auto color1 = _palette[(colors & 0xFF00) >> 8];
-                        const auto color2 = _palette[colors & 0xFF];
+                    break;
+                }
 
-                        for (size_t n = 0; n < 4; ++n) {
-                            for (size_t m = 0; m < 4; ++m) {
-                                if (map & (1 << (n * 4 + m))) {
-                                    std::copy(color1.begin(), color1.end(), t + skip + m * 3);
-                                } else {
-                                    std::copy(color2.begin(), color2.end(), t + skip + m * 3);
+                case frame_type::full: {
+                    const uint8_t mode = _version4 ? read_mode() : FULL_MODE_ROWS;
+                    const auto store = [](uint8_t *t, uint32_t row) {
+                        if constexpr (std::endian::native != std::endian::little) {
+                            row = std::byteswap(row);
+                        }
+                        std::memcpy(t, &row, sizeof(row));
+                    };
+
+                    for (; count > 0 && by < blocks_high; --count) {
+                        if constexpr (Preview) {
+                            // every symbol still has to be consumed, only the top left index is kept
+                            const size_t top_left = mode == FULL_MODE_DOUBLED ? 0 : 1;
+                            for (size_t n = 0; n < full_symbols[mode]; ++n) {
+                                const auto symbol = read(_full);
+                                if (n == top_left) {
+                                    _preview_indices[by * blocks_wide + bx] = symbol & 0xFF;
                                 }
                             }
+                        } else {
+                            uint8_t *t = _index_data.data() + by * 4 * _width + bx * 4;
+                            switch (mode) {
+                                case FULL_MODE_ROWS:
+                                    for (size_t n = 0; n < 4; ++n) {
+                                        // each symbol holds two indices, the first one the right half of the row
+                                        const uint32_t right = read(_full);
+                                        const uint32_t left = read(_full);
+                                        store(t, left | (right << 16));
+                                        t += _width;
+                                    }
+                                    break;
+
+                                case FULL_MODE_DOUBLED:
+                                    // one symbol per two rows, every index twice as wide
+                                    for (size_t n = 0; n < 2; ++n) {
+                                        const uint32_t symbol = read(_full);
+                                        const uint32_t row = (symbol & 0xFF) * 0x0101 | ((symbol >> 8) * 0x0101) << 16;
+                                        store(t, row);
+                                        store(t + _width, row);
+                                        t += _width * 2;
+                                    }
+                                    break;
+
+                                case FULL_MODE_HALVES:
+                                    for (size_t n = 0; n < 2; ++n) {
+                                        const uint32_t right = read(_full);
+                                        const uint32_t left = read(_full);
+                                        store(t, left | (right << 16));
+                                        store(t + _width, left | (right << 16));
+                                        t += _width * 2;
+                                    }
+                                    break;
+                            }
+                        }
 
-                            skip += _width * 3;
+                        mark(1, 1);
+                        advance(1);
+                    }
+
+                    break;
+                }
+
+                case frame_type::void_:
+                    mark(count, 0);
+                    advance(count);
+                    break;
+
+                case frame_type::solid: {
+                    // the whole chain in runs of up to one block row
+                    while (count > 0 && by < blocks_high) {
+                        const size_t run = std::min(count, blocks_wide - bx);
+                        if constexpr (Preview) {
+                            std::memset(_preview_indices.data() + by * blocks_wide + bx, typedata, run);
+                        } else {
+                            uint8_t *t = _index_data.data() + by * 4 * _width + bx * 4;
+                            for (size_t n = 0; n < 4; ++n) {
+                                std::memset(t, typedata, run * 4);
+                                t += _width;
+                            }
                         }
 
-                        break;
+                        mark(run, 1);
+                        count -= run;
+                        advance(run);
                     }
 
-                    case frame_type::full: {
-                        for (size_t n = 0; n < 4; ++n) {
-                            auto full = _lookup_hoff16(_full);
+                    break;
+                }
 
-                            const auto color1 = _palette[(full & 0xFF00) >> 8];
-                            const auto color2 = _palette[full & 0xFF];
+                default:
+                    throw std::runtime_error(std::format("Invalid block type: {}", type));
+            }
+        }
+    }
 
-                            std::copy(color1.begin(), color1.end(), t + skip + 3 * 3);
-                            std::copy(color2.begin(), color2.end(), t + skip + 2 * 3);
+    size_t decoder::bytes_per_pixel(pixel_format format) {
+        switch (format) {
+            case pixel_format::rgb24:
+            case pixel_format::bgr24:
+                return 3;
+            case pixel_format::rgba8888:
+            case pixel_format::bgra8888:
+                return 4;
+            case pixel_format::rgb565:
+                return 2;
+        }
 
-                            full = _lookup_hoff16(_full);
+        throw std::runtime_error(std::format("Invalid pixel format: {}", static_cast<int>(format)));
+    }
 
-                            const auto color3 = _palette[(full & 0xFF00) >> 8];
-                            const auto color4 = _palette[full & 0xFF];
+    std::span<uint8_t> decoder::decode_frame() {
+        _frame_data.resize(_width * height() * 3);
+        decode_frame({ _frame_data.data(), _width * 3, pixel_format::rgb24 });
 
-                            std::copy(color3.begin(), color3.end(), t + skip + 3);
-                            std::copy(color4.begin(), color4.end(), t + skip);
+        return _frame_data;
+    }
 
-                            skip += _width * 3;
-                        }
+    void decoder::decode_frame(const surface &target) {
+        if (target.stride < _width * bytes_per_pixel(target.format)) {
+            throw std::runtime_error(std::format("Stride too small: {}", target.stride));
+        }
 
-                        break;
-                    }
+        _set_preview(false);
+        _decode_indices();
+        _expand_frame(_index_data, _width, _height, target, _y_doubled || _y_interlaced ? 2 : 1);
+    }
 
-                    case frame_type::void_:
-                        break;
+    void decoder::decode_frame_preview(const surface &target) {
+        if (target.stride < preview_width() * bytes_per_pixel(target.format)) {
+            throw std::runtime_error(std::format("Stride too small: {}", target.stride));
+        }
 
-                    case frame_type::solid: {
-                        const auto color = _palette[typedata & 0xFF];
-                        for (size_t n = 0; n < 4; ++n) {
-                            for (size_t m = 0; m < 4; ++m) {
-                                std::copy(color.begin(), color.end(), t + skip + m * 3);
-                            }
+        _set_preview(true);
+        _decode_indices();
+        _expand_frame(_preview_indices, preview_width(), preview_height(), target, 1);
+    }
 
-                            skip += _width * 3;
-                        }
+    void decoder::_set_preview(bool preview) {
+        if (preview == _preview) {
+            return;
+        }
 
+        _preview = preview;
+        // the plane of the new mode missed every frame since the switch, rebuild it from the last keyframe
+        if (_current_frame > 0 && _current_frame < _num_frames) {
+            if (!_input.seekable()) {
+                throw std::runtime_error("Switching between preview and full frames needs a seekable input");
+            }
+            seek(_current_frame);
+        }
+    }
+
+    template<size_t N>
+    static void expand_row(const uint8_t *indices, size_t count, const surface_palette &palette, uint8_t *data) {
+        for (size_t n = 0; n < count; ++n) {
+            std::memcpy(data + n * N, palette[indices[n]].data(), N);
+        }
+    }
+
+    void decoder::_expand_frame(std::span<const uint8_t> indices, uint32_t width, uint32_t height, const surface &target, uint32_t y_scale) {
+        if (!_surface_palette_valid || _surface_palette_format != target.format) {
+            for (size_t n = 0; n < _palette.size(); ++n) {
+                const auto [r, g, b] = _palette[n];
+                switch (target.format) {
+                    case pixel_format::rgb24:
+                    case pixel_format::rgba8888:
+                        _surface_palette[n] = { r, g, b, 0xFF };
+                        break;
+                    case pixel_format::bgr24:
+                    case pixel_format::bgra8888:
+                        _surface_palette[n] = { b, g, r, 0xFF };
+                        break;
+                    case pixel_format::rgb565: {
+                        const uint16_t color = ((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3);
+                        std::memcpy(_surface_palette[n].data(), &color, sizeof(color));
                         break;
                     }
-
-                    default:
-                        throw std::runtime_error(std::format("Invalid block type: {}", type));
                 }
+            }
 
-                col += 4;
-                if (col >= _width) {
-                    col = 0;
-                    row += 4;
+            _surface_palette_format = target.format;
+            _surface_palette_valid = true;
+        }
+
+        const size_t pixel_size = bytes_per_pixel(target.format);
+        auto expand = select_kernels(_simd).expand_row4;
+        if (pixel_size == 2) {
+            expand = expand_row<2>;
+        } else if (pixel_size == 3) {
+            expand = expand_row<3>;
+        }
+
+        // black in the target format, only the alpha channel is set
+        std::array<uint8_t, 4> black{};
+        if (target.format == pixel_format::rgba8888 || target.format == pixel_format::bgra8888) {
+            black[3] = 0xFF;
+        }
+
+        const size_t row_size = width * pixel_size;
+        for (size_t y = 0; y < height; ++y) {
+            uint8_t *t = target.data + y * y_scale * target.stride;
+            expand(indices.data() + y * width, width, _surface_palette, t);
+
+            // the second row is written while the first one is still in cache
+            if (y_scale == 2 && _y_interlaced) {
+                for (size_t n = 0; n < row_size; n += pixel_size) {
+                    std::memcpy(t + target.stride + n, black.data(), pixel_size);
                 }
+            } else if (y_scale == 2) {
+                std::memcpy(t + target.stride, t, row_size);
+            }
+        }
+    }
+
+    decoder::indexed_frame decoder::decode_frame_indexed() {
+        _set_preview(false);
+        _decode_indices();
+
+        return { _index_data, _palette, _palette_changed };
+    }
+
+    void decoder::_decode_indices() {
+        const auto old_palette = _palette;
+        const auto decode_blocks = [this](const auto &read, const auto &read_mode) {
+            if (_preview) {
+                _decode_blocks<true>(read, read_mode);
+            } else {
+                _decode_blocks<false>(read, read_mode);
+            }
+        };
+
+        if (_threads > 1) {
+            _schedule_frames();
+
+            auto frame = _pending.front().get();
+            _pending.pop_front();
+
+            _buffer_storage = std::move(frame.storage);
+            _buffer = frame.data;
+            _buffer_pos = 0;
+
+            if (_frame_types[_current_frame] & 0x01) {
+                _read_palette();
+            }
+            _read_audio();
+
+            const uint16_t *symbol = frame.symbols.data();
+            const auto next = [&] { return *symbol++; };
+            decode_blocks([&](const huff16 &) { return next(); }, next);
+        } else {
+            _read_buffer(_frame_sizes[_current_frame] & ~0x03); // 1st bottom bit indicates keyframe, 2nd bottom bit is reversed
+
+            if (_frame_types[_current_frame] & 0x01) {
+                _read_palette();
             }
+            _read_audio();
+
+            std::ranges::fill(_mmap.cache, 0);
+            std::ranges::fill(_mclr.cache, 0);
+            std::ranges::fill(_full.cache, 0);
+            std::ranges::fill(_type.cache, 0);
+
+            _init_bitstream();
+            decode_blocks([this](huff16 &tree) { return _lookup_hoff16(tree); }, [this] { return _read_full_mode(_bitstream); });
         }
 
+        _palette_changed = std::exchange(_palette_reset, false) || _palette != old_palette;
+        if (_palette_changed) {
+            _surface_palette_valid = false;
+            std::ranges::fill(_changed_blocks, 1);
+        }
         ++_current_frame;
-        _file.seekg(end_of_frame);
+    }
 
-        return _frame_data;
+    std::vector<decoder::rect> decoder::changed_regions() const {
+        const size_t blocks_wide = _width / 4;
+        const size_t blocks_high = _height / 4;
+
+        // doubled and interlaced blocks cover twice the rows of the decoded frame
+        const uint32_t block_height = _y_doubled || _y_interlaced ? 8 : 4;
+
+        // runs of changed blocks per block row, a run with the same extent as one directly above grows that rectangle
+        std::vector<rect> regions;
+        std::vector<size_t> open, next;
+        for (size_t by = 0; by < blocks_high; ++by) {
+            const uint8_t *row = _changed_blocks.data() + by * blocks_wide;
+            size_t above = 0;
+            next.clear();
+
+            for (size_t bx = 0; bx < blocks_wide;) {
+                if (!row[bx]) {
+                    ++bx;
+                    continue;
+                }
+
+                const size_t start = bx;
+                while (bx < blocks_wide && row[bx]) {
+                    ++bx;
+                }
+
+                const uint32_t x = start * 4;
+                const uint32_t width = (bx - start) * 4;
+                while (above < open.size() && regions[open[above]].x < x) {
+                    ++above;
+                }
+
+                if (above < open.size() && regions[open[above]].x == x && regions[open[above]].width == width) {
+                    regions[open[above]].height += block_height;
+                    next.push_back(open[above]);
+                    ++above;
+                } else {
+                    regions.push_back({ x, static_cast<uint32_t>(by * block_height), width, block_height });
+                    next.push_back(regions.size() - 1);
+                }
+            }
+
+            std::swap(open, next);
+        }
+
+        return regions;
     }
 
-    void decoder::_init_bitstream() {
-        _current_byte = _file.get();
-        _current_bit = 0;
+    void decoder::_schedule_frames() {
+        for (_next_frame = std::max(_next_frame, _current_frame); _next_frame < _num_frames && _pending.size() < _threads; ++_next_frame) {
+            auto data = _input.read(_frame_sizes[_next_frame] & ~0x03);
+
+            // views into a persistent input stay valid, anything else has to be copied before the next read
+            std::vector<uint8_t> storage;
+            if (!_input.persistent()) {
+                storage.assign(data.begin(), data.end());
+                data = storage;
+            }
+
+            const size_t palette_size = _frame_types[_next_frame] & 0x01 && !data.empty() ? data[0] * 4 : 0;
+            if (palette_size > data.size()) {
+                throw std::runtime_error("Palette exceeds frame");
+            }
+
+            std::array<std::span<const uint8_t>, max_audio_tracks> chunks;
+            const size_t video_offset = read_audio_chunks(data, palette_size, _frame_types[_next_frame], chunks);
+
+            _pending.emplace_back(std::async(std::launch::async, [this, storage = std::move(storage), data, video_offset]() mutable {
+                auto symbols = _decode_symbols(data.subspan(video_offset));
+                return decoded_frame{ std::move(storage), data, std::move(symbols) };
+            }));
+        }
     }
 
-    bool decoder::_bitstream_read_bit() {
-        const bool result = (_current_byte >> _current_bit) & 1;
+    std::vector<uint16_t> decoder::_decode_symbols(std::span<const uint8_t> data) const {
+        bitstream bits{ data.data(), data.size() };
+        std::array<uint16_t, 3> mmap_cache{}, mclr_cache{}, full_cache{}, type_cache{};
+
+        const size_t num_blocks = (_width / 4) * (_height / 4);
+        std::vector<uint16_t> symbols;
+        symbols.reserve(num_blocks * 2);
+
+        for (size_t block = 0; block < num_blocks;) {
+            const auto type = _lookup_hoff16(_type, bits, type_cache);
+            symbols.push_back(type);
+
+            const auto count = std::min(sizetable[(type & 0x00FC) >> 2], num_blocks - block);
+            switch (static_cast<frame_type>(type & 0x0003)) {
+                case frame_type::mono:
+                    for (size_t n = 0; n < count; ++n) {
+                        symbols.push_back(_lookup_hoff16(_mclr, bits, mclr_cache));
+                        symbols.push_back(_lookup_hoff16(_mmap, bits, mmap_cache));
+                    }
+                    break;
 
-        if (++_current_bit > 7) {
-            _current_byte = _file.get();
-            _current_bit = 0;
+                case frame_type::full: {
+                    // the version 4 layout goes along with the symbols, _decode_blocks reads it back in order
+                    const uint8_t mode = _version4 ? _read_full_mode(bits) : FULL_MODE_ROWS;
+                    if (_version4) {
+                        symbols.push_back(mode);
+                    }
+                    for (size_t n = 0; n < count * full_symbols[mode]; ++n) {
+                        symbols.push_back(_lookup_hoff16(_full, bits, full_cache));
+                    }
+                    break;
+                }
+
+                default:
+                    break;
+            }
+
+            block += count;
         }
 
-        return result;
+        return symbols;
     }
 
-    uint8_t decoder::_bitstream_read_byte() {
-        if (_current_bit == 0) {
-            const uint8_t result = _current_byte;
-            _current_byte = _file.get();
-            return result;
+    void decoder::_read_buffer(size_t size) {
+        _buffer = _input.read(size);
+        _buffer_pos = 0;
+    }
+
+    void decoder::_init_bitstream() {
+        _bitstream = { _buffer.data() + _buffer_pos, _buffer.size() - _buffer_pos };
+    }
+
+    void decoder::bitstream::refill() {
+        uint64_t word = 0;
+        if (size - pos >= sizeof(word)) {
+            std::memcpy(&word, data + pos, sizeof(word));
+            if constexpr (std::endian::native != std::endian::little) {
+                word = std::byteswap(word);
+            }
+        } else {
+            // past the end of the section the stream reads as zeros
+            for (size_t n = 0; n < size - pos; ++n) {
+                word |= static_cast<uint64_t>(data[pos + n]) << (n * 8);
+            }
         }
 
-        const uint8_t result = _current_byte >> _current_bit;
-        _current_byte = _file.get();
+        // only whole bytes are consumed, the partially loaded top byte is loaded again by the next refill
+        bits |= word << bits_in_buffer;
+        pos = std::min(pos + ((63 - bits_in_buffer) >> 3), size);
+        bits_in_buffer |= 56;
+    }
 
-        return result | (_current_byte << (8 - _current_bit) & 0xFF);
+    uint32_t decoder::bitstream::peek(uint8_t count) {
+        if (bits_in_buffer < count) {
+            refill();
+        }
+
+        return bits & ((uint64_t{1} << count) - 1);
     }
 
-    decoder::huff16 decoder::_build_hoff16() {
+    void decoder::bitstream::skip(uint8_t count) {
+        bits >>= count;
+        bits_in_buffer -= count;
+    }
+
+    bool decoder::_bitstream_read_bit() {
+        const bool result = _bitstream.peek(1);
+        _bitstream.skip(1);
+        return result;
+    }
+
+    uint8_t decoder::_bitstream_read_byte() {
+        const uint8_t result = _bitstream.peek(8);
+        _bitstream.skip(8);
+        return result;
+    }
+
+    decoder::huff16 decoder::_build_hoff16(uint32_t size) {
         if (!_bitstream_read_bit()) {
             throw std::runtime_error("Huff16 not present");
         }
@@ -253,68 +888,184 @@ namespace smk {
         tree.cache[1] = _bitstream_read_byte() | (_bitstream_read_byte() << 8);
         tree.cache[2] = _bitstream_read_byte() | (_bitstream_read_byte() << 8);
 
-        _build_hoff16_rec(tree, low_tree, high_tree, "");
+        // the header size is in bytes and includes the three cache values
+        const size_t capacity = std::min<size_t>((static_cast<size_t>(size) + 3) / 4, HUFF16_MAX_NODES);
+        if (_tree_nodes.size() < capacity) {
+            _tree_nodes.resize(capacity);
+        }
+
+        // branches still waiting for their one child form a stack linked through their own slots
+        size_t count = 0;
+        uint32_t pending = HUFF16_LEAF_MASK;
+        while (true) {
+            if (count >= capacity) {
+                throw std::runtime_error("Huff16 exceeds its declared size");
+            }
+
+            if (_bitstream_read_bit()) {
+                _tree_nodes[count] = HUFF16_BRANCH | pending;
+                pending = count++;
+                continue;
+            }
+
+            uint32_t value = _lookup_hoff8(low_tree) | (_lookup_hoff8(high_tree) << 8);
+            if (value == tree.cache[0]) {
+                value = HUFF16_CACHE;
+            } else if (value == tree.cache[1]) {
+                value = HUFF16_CACHE | 1;
+            } else if (value == tree.cache[2]) {
+                value = HUFF16_CACHE | 2;
+            }
+            _tree_nodes[count++] = value;
+
+            if (pending == HUFF16_LEAF_MASK) {
+                break;
+            }
+
+            const auto branch = pending;
+            pending = _tree_nodes[branch] & HUFF16_LEAF_MASK;
+            _tree_nodes[branch] = HUFF16_BRANCH | count;
+        }
 
         if (_bitstream_read_bit()) {
             throw std::runtime_error("Error reading huff16");
         }
 
+        _build_hoff16_table(tree, std::span<const uint32_t>(_tree_nodes).first(count));
+
         return tree;
     }
 
-    uint16_t decoder::_lookup_hoff16(huff16 &tree) {
-        size_t index = 0;
-        while (tree.tree[index] & HUFF16_BRANCH) {
-            if (_bitstream_read_bit()) {
-                index = tree.tree[index] & HUFF16_LEAF_MASK;
-            } else {
-                ++index;
+    void decoder::_build_hoff16_table(huff16 &tree, std::span<const uint32_t> nodes) {
+        if (_tree_heights.size() < nodes.size()) {
+            _tree_heights.resize(nodes.size());
+        }
+        for (size_t n = nodes.size(); n-- > 0;) {
+            _tree_heights[n] = 0;
+            if (nodes[n] & HUFF16_BRANCH) {
+                // saturates, only heights up to the table width matter
+                _tree_heights[n] = std::min(1 + std::max(_tree_heights[n + 1], _tree_heights[nodes[n] & HUFF16_LEAF_MASK]), 0xFF);
             }
         }
 
-        auto value = tree.tree[index];
-        if (value & HUFF16_CACHE) {
-            value = tree.cache[value & HUFF16_LEAF_MASK];
+        struct pending {
+            size_t node;
+            size_t offset;
+            uint8_t bits;
+            uint8_t depth;
+            uint32_t code;
+        };
+
+        tree.table_bits = std::min(_tree_heights[0], HUFF16_TABLE_BITS);
+        tree.table.assign(size_t{1} << tree.table_bits, 0);
+
+        std::vector<pending> stack{ { 0, 0, tree.table_bits, 0, 0 } };
+        while (!stack.empty()) {
+            const auto current = stack.back();
+            stack.pop_back();
+
+            const auto node = nodes[current.node];
+            if (!(node & HUFF16_BRANCH)) {
+                const uint32_t value = node & HUFF16_CACHE ? HUFF16_TABLE_CACHE | (node & HUFF16_LEAF_MASK) : node;
+                const uint32_t entry = (current.depth << 24) | value;
+                for (size_t n = current.code; n < (size_t{1} << current.bits); n += size_t{1} << current.depth) {
+                    tree.table[current.offset + n] = entry;
+                }
+                continue;
+            }
+
+            if (current.depth == current.bits) {
+                const auto bits = std::min(_tree_heights[current.node], HUFF16_TABLE_BITS);
+                const auto offset = tree.table.size();
+                tree.table[current.offset + current.code] = HUFF16_TABLE_LINK | (bits << 24) | static_cast<uint32_t>(offset);
+                tree.table.resize(offset + (size_t{1} << bits));
+                stack.emplace_back(pending{ node & HUFF16_LEAF_MASK, offset, bits, 1, 1 });
+                stack.emplace_back(pending{ current.node + 1, offset, bits, 1, 0 });
+                continue;
+            }
+
+            stack.emplace_back(pending{ node & HUFF16_LEAF_MASK, current.offset, current.bits, static_cast<uint8_t>(current.depth + 1), current.code | (1u << current.depth) });
+            stack.emplace_back(pending{ current.node + 1, current.offset, current.bits, static_cast<uint8_t>(current.depth + 1), current.code });
         }
+    }
+
+    uint16_t decoder::_lookup_hoff16(huff16 &tree) {
+        return _lookup_hoff16(tree, _bitstream, tree.cache);
+    }
 
-        if (value != tree.cache[0]) {
-            std::rotate(tree.cache.begin(), tree.cache.begin() + 2, tree.cache.begin() + 3);
-            tree.cache[0] = value;
+    // 1 selects the doubled layout, 01 the halves and 00 the plain rows
+    uint8_t decoder::_read_full_mode(bitstream &bits) {
+        const bool doubled = bits.peek(1);
+        bits.skip(1);
+        if (doubled) {
+            return FULL_MODE_DOUBLED;
         }
 
-        return value;
+        const bool halves = bits.peek(1);
+        bits.skip(1);
+        return halves ? FULL_MODE_HALVES : FULL_MODE_ROWS;
     }
 
-    void decoder::_build_hoff16_rec(huff16 &tree, const std::vector<uint16_t> &low_tree, const std::vector<uint16_t> &high_tree, std::string code) {
-        if (_bitstream_read_bit()) {
-            const auto branch = tree.tree.size();
-            tree.tree.emplace_back(0);
-            _build_hoff16_rec(tree, low_tree, high_tree, code + "0");
-            tree.tree[branch] = HUFF16_BRANCH | tree.tree.size();
-            _build_hoff16_rec(tree, low_tree, high_tree, code + "1");
-        } else {
-            uint32_t value = _lookup_hoff8(low_tree) | (_lookup_hoff8(high_tree) << 8);
+    uint32_t decoder::_lookup_table(const huff16 &tree, bitstream &bits) {
+        auto table_bits = tree.table_bits;
+        auto entry = tree.table[bits.peek(table_bits)];
+        while (entry & HUFF16_TABLE_LINK) {
+            bits.skip(table_bits);
+            table_bits = (entry >> 24) & 0x1F;
+            entry = tree.table[(entry & HUFF16_TABLE_OFFSET_MASK) + bits.peek(table_bits)];
+        }
+        bits.skip(entry >> 24);
 
-            if (value == tree.cache[0]) {
-                value = HUFF16_CACHE;
-            } else if (value == tree.cache[1]) {
-                value = HUFF16_CACHE | 1;
-            } else if (value == tree.cache[2]) {
-                value = HUFF16_CACHE | 2;
-            }
+        return entry & (HUFF16_TABLE_CACHE | HUFF16_TABLE_VALUE_MASK);
+    }
+
+    uint16_t decoder::_lookup_hoff16(const huff16 &tree, bitstream &bits, std::array<uint16_t, 3> &cache) {
+        const auto entry = _lookup_table(tree, bits);
+
+        uint16_t value = entry & HUFF16_TABLE_VALUE_MASK;
+        if (entry & HUFF16_TABLE_CACHE) {
+            value = cache[value];
+        }
 
-            tree.tree.emplace_back(value);
+        if (value != cache[0]) {
+            std::rotate(cache.begin(), cache.begin() + 2, cache.begin() + 3);
+            cache[0] = value;
         }
+
+        return value;
     }
 
-    std::vector<uint16_t> decoder::_build_hoff8() {
+    decoder::huff8 decoder::_build_hoff8() {
         if (!_bitstream_read_bit()) {
             throw std::runtime_error("Huff8 not present");
         }
 
-        std::vector<uint16_t> tree;
-        tree.reserve(511);
-        _build_hoff8_rec(tree, "");
+        huff8 tree;
+
+        // same linked stack of pending branches as in _build_hoff16
+        size_t count = 0;
+        uint16_t pending = HUFF8_LEAF_MASK;
+        while (true) {
+            if (count >= tree.size()) {
+                throw std::runtime_error("Huff8 has too many nodes");
+            }
+
+            if (_bitstream_read_bit()) {
+                tree[count] = HUFF8_BRANCH | pending;
+                pending = count++;
+                continue;
+            }
+
+            tree[count++] = _bitstream_read_byte();
+
+            if (pending == HUFF8_LEAF_MASK) {
+                break;
+            }
+
+            const auto branch = pending;
+            pending = tree[branch] & HUFF8_LEAF_MASK;
+            tree[branch] = HUFF8_BRANCH | count;
+        }
 
         if (_bitstream_read_bit()) {
             throw std::runtime_error("Error reading huff8");
@@ -323,20 +1074,7 @@ namespace smk {
         return tree;
     }
 
-    void decoder::_build_hoff8_rec(std::vector<uint16_t> &tree, std::string code) {
-        if (_bitstream_read_bit()) {
-            const auto branch = tree.size();
-            tree.emplace_back(0);
-            _build_hoff8_rec(tree, code + "0");
-            tree[branch] = HUFF8_BRANCH | tree.size();
-            _build_hoff8_rec(tree, code + "1");
-        } else {
-            const auto value = _bitstream_read_byte();
-            tree.emplace_back(value);
-        }
-    }
-
-    uint8_t decoder::_lookup_hoff8(const std::vector<uint16_t> &tree) {
+    uint8_t decoder::_lookup_hoff8(const huff8 &tree) {
         size_t index = 0;
         while (tree[index] & HUFF8_BRANCH) {
             if (_bitstream_read_bit()) {
@@ -348,6 +1086,134 @@ namespace smk {
         return tree[index];
     }
 
+    void decoder::_build_audio_tree(huff16 &tree) {
+        const auto nodes = _build_hoff8();
+
+        // the rightmost path ends at the last node
+        size_t count = 0;
+        while (nodes[count] & HUFF8_BRANCH) {
+            count = nodes[count] & HUFF8_LEAF_MASK;
+        }
+        ++count;
+
+        if (_tree_nodes.size() < count) {
+            _tree_nodes.resize(count);
+        }
+        for (size_t n = 0; n < count; ++n) {
+            _tree_nodes[n] = nodes[n] & HUFF8_BRANCH ? HUFF16_BRANCH | (nodes[n] & HUFF8_LEAF_MASK) : nodes[n];
+        }
+
+        _build_hoff16_table(tree, std::span<const uint32_t>(_tree_nodes).first(count));
+    }
+
+    void decoder::_read_audio() {
+        _buffer_pos = read_audio_chunks(_buffer, _buffer_pos, _frame_types[_current_frame], _audio_chunks);
+    }
+
+    size_t decoder::audio_size(size_t track) const {
+        if (track >= max_audio_tracks) {
+            throw std::runtime_error(std::format("Invalid audio track: {}", track));
+        }
+
+        const auto chunk = _audio_chunks[track];
+        if (chunk.empty() || !_audio_tracks[track].compressed) {
+            return chunk.size();
+        }
+
+        if (chunk.size() < sizeof(uint32_t)) {
+            throw std::runtime_error("Audio chunk too small");
+        }
+        uint32_t size;
+        std::memcpy(&size, chunk.data(), sizeof(size));
+        if constexpr (std::endian::native != std::endian::little) {
+            size = std::byteswap(size);
+        }
+        return size;
+    }
+
+    size_t decoder::decode_audio(size_t track, std::span<uint8_t> pcm) {
+        const size_t size = audio_size(track);
+        if (pcm.size() < size) {
+            throw std::runtime_error(std::format("Audio buffer too small: {} < {}", pcm.size(), size));
+        }
+        if (size == 0) {
+            return 0;
+        }
+
+        const auto &info = _audio_tracks[track];
+        const auto chunk = _audio_chunks[track];
+        const size_t sample_size = info.bits / 8;
+
+        if (!info.compressed) {
+            std::ranges::copy(chunk, pcm.begin());
+            if constexpr (std::endian::native != std::endian::little) {
+                if (sample_size == 2) {
+                    for (size_t n = 0; n + 1 < size; n += 2) {
+                        std::swap(pcm[n], pcm[n + 1]);
+                    }
+                }
+            }
+            return size;
+        }
+
+        _bitstream = { chunk.data() + sizeof(uint32_t), chunk.size() - sizeof(uint32_t) };
+        if (!_bitstream_read_bit()) {
+            return 0;
+        }
+
+        const bool stereo = _bitstream_read_bit();
+        const bool wide = _bitstream_read_bit();
+        if (stereo != (info.channels == 2) || wide != (info.bits == 16)) {
+            throw std::runtime_error(std::format("Audio chunk does not match track {}", track));
+        }
+        if (size % (info.channels * sample_size) != 0) {
+            throw std::runtime_error(std::format("Invalid audio size: {}", size));
+        }
+
+        // one tree per channel, 16-bit samples have separate trees for the low and the high byte
+        const size_t num_trees = size_t{1} << (stereo + wide);
+        for (size_t n = 0; n < num_trees; ++n) {
+            _build_audio_tree(_audio_trees[n]);
+        }
+
+        // samples are deltas to the previous sample of the same channel and wrap around instead of clipping
+        const size_t count = size / sample_size;
+        if (wide) {
+            std::array<uint16_t, 2> pred;
+            for (size_t n = info.channels; n-- > 0;) {
+                const uint16_t high = _bitstream_read_byte();
+                pred[n] = (high << 8) | _bitstream_read_byte();
+            }
+
+            uint8_t *t = pcm.data();
+            for (size_t n = 0; n < count; ++n) {
+                const size_t channel = n & stereo;
+                if (n >= info.channels) {
+                    const uint32_t low = _lookup_table(_audio_trees[channel * 2], _bitstream);
+                    const uint32_t high = _lookup_table(_audio_trees[channel * 2 + 1], _bitstream);
+                    pred[channel] += low | (high << 8);
+                }
+                std::memcpy(t, &pred[channel], sizeof(uint16_t));
+                t += sizeof(uint16_t);
+            }
+        } else {
+            std::array<uint8_t, 2> pred;
+            for (size_t n = info.channels; n-- > 0;) {
+                pred[n] = _bitstream_read_byte();
+            }
+
+            for (size_t n = 0; n < count; ++n) {
+                const size_t channel = n & stereo;
+                if (n >= info.channels) {
+                    pred[channel] += _lookup_table(_audio_trees[channel], _bitstream);
+                }
+                pcm[n] = pred[channel];
+            }
+        }
+
+        return size;
+    }
+
     void decoder::_read_palette() {
         palette old_palette;
         std::ranges::copy(_palette, old_palette.begin());
@@ -363,20 +1229,33 @@ namespace smk {
             0xE3, 0xE7, 0xEB, 0xEF, 0xF3, 0xF7, 0xFB, 0xFF
         };
 
+        if (_buffer_pos >= _buffer.size()) {
+            throw std::runtime_error("Palette exceeds frame");
+        }
+
         palette::iterator n = _palette.begin();
-        const auto palette_end = _file.tellg() + static_cast<std::istream::pos_type>(_file.get() * 4);
-        while (_file.tellg() < palette_end) {
-            const uint8_t block = _file.get();
+        const auto palette_end = _buffer_pos + _buffer[_buffer_pos] * 4;
+        if (palette_end > _buffer.size()) {
+            throw std::runtime_error("Palette exceeds frame");
+        }
+        ++_buffer_pos;
+
+        const auto next = [&]() -> uint8_t {
+            return _buffer_pos < _buffer.size() ? _buffer[_buffer_pos++] : 0;
+        };
+
+        while (_buffer_pos < palette_end) {
+            const uint8_t block = next();
             if (block & 0x80) {
                 n += (block & 0x7F) + 1;
             } else if (block & 0x40) {
                 const uint8_t c = (block & 0x3F) + 1;
-                const uint8_t s = _file.get();
+                const uint8_t s = next();
                 n = std::ranges::copy_n(old_palette.begin() + s, c, n).out;
             } else {
                 const uint8_t r = palmap[block & 0x3F];
-                const uint8_t g = palmap[_file.get() & 0x3F];
-                const uint8_t b = palmap[_file.get() & 0x3F];
+                const uint8_t g = palmap[next() & 0x3F];
+                const uint8_t b = palmap[next() & 0x3F];
                 *n++ = {r, g, b};
             }
 
@@ -385,6 +1264,6 @@ namespace smk {
             }
         }
 
-        _file.seekg(palette_end);
+        _buffer_pos = palette_end;
     }
 }
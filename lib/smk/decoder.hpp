@@ -1,42 +1,167 @@
 #pragma once
 
 #include <cstdint>
+#include <chrono>
 #include <istream>
 #include <span>
-#include <string>
 #include <array>
+#include <limits>
+#include <deque>
+#include <future>
 #include <vector>
+#include <memory>
+
+#include "../io/input.hpp"
 
 namespace smk {
     class decoder {
     public:
+        struct options {
+            // worker threads entropy decoding upcoming frames while the calling thread reconstructs pixels
+            size_t threads = 1;
+            // SSE2/AVX2 block kernels where the CPU has them, off forces the portable ones
+            bool simd = true;
+        };
+
+        using palette = std::array<std::array<uint8_t, 3>, 256>;
+
+        struct indexed_frame {
+            // one palette index per pixel of the stored rows, width * height bytes, half of height() if rows are doubled or interlaced
+            std::span<const uint8_t> indices;
+            const palette &colors;
+            // set on the first frame and whenever a palette chunk changed the colors
+            bool palette_changed;
+        };
+
+        enum class pixel_format : uint8_t {
+            rgb24,
+            bgr24,
+            rgba8888,
+            bgra8888,
+            // native endian 16-bit words
+            rgb565,
+        };
+
+        struct surface {
+            uint8_t *data;
+            // bytes between the starts of two rows, at least width * bytes_per_pixel(format)
+            size_t stride;
+            pixel_format format;
+        };
+
+        static size_t bytes_per_pixel(pixel_format format);
+
+        struct audio_track {
+            // samples per second and channel, 0 if the file has no such track
+            uint32_t rate;
+            uint8_t channels;
+            // 8-bit samples are unsigned, 16-bit samples signed in native byte order
+            uint8_t bits;
+            bool compressed;
+            // largest decoded audio of one frame in bytes, as declared by the header
+            uint32_t max_size;
+        };
+
+        static constexpr size_t max_audio_tracks = 7;
+
+        struct rect {
+            uint32_t x;
+            uint32_t y;
+            uint32_t width;
+            uint32_t height;
+        };
+
         explicit decoder(std::istream &file);
+        explicit decoder(std::istream &file, const options &options);
+        explicit decoder(io::input &input);
+        explicit decoder(io::input &input, const options &options);
         std::span<uint8_t> decode_frame();
+        void decode_frame(const surface &target);
+        indexed_frame decode_frame_indexed();
+
+        // one pixel per 4x4 block into a preview_width() x preview_height() surface, the block's solid color,
+        // the more frequent mono color or the top left pixel of a full block; switching between preview and
+        // full frames mid-stream replays from the last keyframe, so it needs a seekable input
+        void decode_frame_preview(const surface &target);
+        uint32_t preview_width() const { return _width / 4; }
+        uint32_t preview_height() const { return _height / 4; }
+
+        // continues decoding at the given frame, starting from the closest keyframe before it, needs a seekable input
+        void seek(size_t frame);
+
+        size_t current_frame() const { return _current_frame; }
+
+        const std::array<audio_track, max_audio_tracks> &audio_tracks() const { return _audio_tracks; }
+        // bytes of PCM the last decoded frame carries for the track, 0 if it has none
+        size_t audio_size(size_t track) const;
+        // decodes the track's audio of the last decoded frame into pcm as interleaved samples, returns the bytes written
+        size_t decode_audio(size_t track, std::span<uint8_t> pcm);
+
+        // one byte per 4x4 block in row-major order, nonzero where the last decoded frame changed pixels,
+        // a palette change marks every block since all colors may have moved
+        std::span<const uint8_t> changed_blocks() const { return _changed_blocks; }
+        // the changed blocks merged into rectangles, in pixels of the decoded frame
+        std::vector<rect> changed_regions() const;
 
         uint32_t width() const { return _width; }
-        uint32_t height() const { return _height; }
+        // rows of a decoded frame, twice the stored rows for doubled or interlaced files
+        uint32_t height() const { return _y_doubled || _y_interlaced ? _height * 2 : _height; }
+        // every stored row is shown twice, or followed by a black row if interlaced; indexed and preview frames
+        // as well as changed_blocks() keep the stored rows
+        bool y_doubled() const { return _y_doubled; }
+        bool y_interlaced() const { return _y_interlaced; }
         uint32_t num_frames() const { return _num_frames; }
         int32_t framerate() const { return _framerate; }
+        // exact display time of one frame, framerate() is rounded to whole frames per second
+        std::chrono::microseconds frame_duration() const { return _frame_duration; }
 
     private:
-        std::istream &_file;
+        explicit decoder(std::unique_ptr<io::input> input, const options &options);
+        void _read_header();
+
+        bool _version4 = false;
+        bool _y_doubled = false;
+        bool _y_interlaced = false;
+
+        std::unique_ptr<io::input> _owned_input;
+        io::input &_input;
         uint32_t _width;
         uint32_t _height;
         uint32_t _num_frames;
         int32_t _framerate;
+        std::chrono::microseconds _frame_duration;
         std::vector<uint32_t> _frame_sizes;
         std::vector<uint8_t> _frame_types;
+        std::vector<uint64_t> _frame_offsets;
+
+        // current section, either a view into the input or into _buffer_storage
+        std::span<const uint8_t> _buffer;
+        std::vector<uint8_t> _buffer_storage;
+        size_t _buffer_pos = 0;
+        void _read_buffer(size_t size);
+
+        struct bitstream {
+            const uint8_t *data = nullptr;
+            size_t size = 0;
+            size_t pos = 0;
+            uint64_t bits = 0;
+            uint8_t bits_in_buffer = 0;
+
+            void refill();
+            uint32_t peek(uint8_t count);
+            void skip(uint8_t count);
+        };
 
-        uint8_t _current_bit;
-        uint8_t _current_byte;
+        bitstream _bitstream;
 
         void _init_bitstream();
         bool _bitstream_read_bit();
         uint8_t _bitstream_read_byte();
 
         struct huff16 {
-        std::vector<uint32_t> tree;
         std::array<uint16_t, 3> cache;
+        std::vector<uint32_t> table;
+        uint8_t table_bits;
         };
 
         huff16 _mmap;
@@ -44,19 +169,67 @@ namespace smk {
         huff16 _full;
         huff16 _type;
 
-        huff16 _build_hoff16();
+        // scratch space shared by all trees, so building them only allocates the lookup tables
+        std::vector<uint32_t> _tree_nodes;
+        std::vector<uint8_t> _tree_heights;
+
+        huff16 _build_hoff16(uint32_t size = std::numeric_limits<uint32_t>::max());
         uint16_t _lookup_hoff16(huff16 &tree);
-        void _build_hoff16_rec(huff16 &tree, const std::vector<uint16_t> &low_tree, const std::vector<uint16_t> &high_tree, std::string code);
+        static uint16_t _lookup_hoff16(const huff16 &tree, bitstream &bits, std::array<uint16_t, 3> &cache);
+        static uint32_t _lookup_table(const huff16 &tree, bitstream &bits);
+        static uint8_t _read_full_mode(bitstream &bits);
+        void _build_hoff16_table(huff16 &tree, std::span<const uint32_t> nodes);
 
-        std::vector<uint16_t> _build_hoff8();
-        uint8_t _lookup_hoff8(const std::vector<uint16_t> &tree);
-        void _build_hoff8_rec(std::vector<uint16_t> &tree, std::string code);
+        using huff8 = std::array<uint16_t, 511>;
+        huff8 _build_hoff8();
+        uint8_t _lookup_hoff8(const huff8 &tree);
+
+        // audio chunks of the last decoded frame, views into _buffer
+        std::array<audio_track, max_audio_tracks> _audio_tracks;
+        std::array<std::span<const uint8_t>, max_audio_tracks> _audio_chunks;
+        // audio uses huff8 trees, kept as lookup tables without the cache
+        std::array<huff16, 4> _audio_trees;
+        void _read_audio();
+        void _build_audio_tree(huff16 &tree);
 
-        using palette = std::array<std::array<uint8_t, 3>, 256>;
         palette _palette;
+        bool _palette_changed = false;
+        bool _palette_reset = true;
         void _read_palette();
 
+        // palette in the byte order of _surface_palette_format, rebuilt when either changes
+        std::array<std::array<uint8_t, 4>, 256> _surface_palette;
+        pixel_format _surface_palette_format = pixel_format::rgb24;
+        bool _surface_palette_valid = false;
+        // with y_scale 2 every row is followed by its copy or a black row
+        void _expand_frame(std::span<const uint8_t> indices, uint32_t width, uint32_t height, const surface &target, uint32_t y_scale);
+
         size_t _current_frame;
+        bool _simd = true;
+        std::vector<uint8_t> _index_data;
+        std::vector<uint8_t> _changed_blocks;
+        // which plane is being kept up to date, the other one is stale
+        bool _preview = false;
+        std::vector<uint8_t> _preview_indices;
+        void _set_preview(bool preview);
         std::vector<uint8_t> _frame_data;
+        void _decode_indices();
+
+        template<bool Preview, typename F, typename M>
+        void _decode_blocks(const F &read, const M &read_mode);
+
+        struct decoded_frame {
+            std::vector<uint8_t> storage;
+            std::span<const uint8_t> data;
+            std::vector<uint16_t> symbols;
+        };
+
+        size_t _threads = 1;
+        size_t _next_frame = 0;
+        std::vector<uint16_t> _decode_symbols(std::span<const uint8_t> data) const;
+        void _schedule_frames();
+
+        // declared last so pending work, which references the trees, finishes before anything is destroyed
+        std::deque<std::future<decoded_frame>> _pending;
     };
 }
@@ -7,6 +7,10 @@
 #include <bit>
 #include <sstream>
 #include <cassert>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <thread>
 
 template<typename T>
 void write_le(std::ostream &file, T value) {
@@ -16,7 +20,59 @@ void write_le(std::ostream &file, T value) {
     file.write(reinterpret_cast<const char*>(&value), sizeof(T));
 }
 
+template<typename T>
+T read_le(std::istream &file) {
+    T value;
+    file.read(reinterpret_cast<char*>(&value), sizeof(T));
+    if constexpr (std::endian::native != std::endian::little) {
+        value = std::byteswap(value);
+    }
+    return value;
+}
+
+template<typename F>
+void parallel_for(size_t count, size_t threads, const F &func) {
+    std::atomic<size_t> next = 0;
+    std::exception_ptr error;
+    std::mutex error_mutex;
+
+    const auto worker = [&] {
+        for (size_t n = next++; n < count; n = next++) {
+            try {
+                func(n);
+            } catch (...) {
+                std::scoped_lock lock(error_mutex);
+                error = std::current_exception();
+                next = count;
+            }
+        }
+    };
+
+    {
+        std::vector<std::jthread> workers;
+        for (size_t n = 1; n < std::min(threads, count); ++n) {
+            workers.emplace_back(worker);
+        }
+        worker();
+    }
+
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
 namespace smk {
+    constexpr std::array<size_t, 64> sizetable = {
+        1,	2,	3,	4,	5,	6,	7,	8,
+        9,	10,	11,	12,	13,	14,	15,	16,
+        17,	18,	19,	20,	21,	22,	23,	24,
+        25,	26,	27,	28,	29,	30,	31,	32,
+        33,	34,	35,	36,	37,	38,	39,	40,
+        41,	42,	43,	44,	45,	46,	47,	48,
+        49,	50,	51,	52,	53,	54,	55,	56,
+        57,	58,	59,	128, 256, 512, 1024, 2048
+    };
+
     encoder::bitstream::bitstream(std::ostream &file) : _file(file) {}
 
     void encoder::bitstream::write(value_type value, uint8_t length) {
@@ -24,39 +80,88 @@ namespace smk {
             throw std::invalid_argument("Length exceeds value type");
         }
 
-        while (length > 0) {
-            const auto bits_to_write = std::min<uint8_t>(length, 8 - _bits_in_buf);
-            const value_type mask = (static_cast<value_type>(1) << bits_to_write) - 1;
-            _buf |= ((value & mask) << _bits_in_buf);
-            _bits_in_buf += bits_to_write;
-            if (_bits_in_buf == 8) {
-                flush();
+        _bits |= (value & ((uint64_t{1} << length) - 1)) << _bits_in_buf;
+        _bits_in_buf += length;
+        if (_bits_in_buf >= 32) {
+            auto word = static_cast<uint32_t>(_bits);
+            if constexpr (std::endian::native != std::endian::little) {
+                word = std::byteswap(word);
             }
-            value >>= bits_to_write;
-            length -= bits_to_write;
+            _buf.append(reinterpret_cast<const char*>(&word), sizeof(word));
+            _bits >>= 32;
+            _bits_in_buf -= 32;
         }
     }
 
     void encoder::bitstream::flush() {
-        if (_bits_in_buf > 0) {
-            _file.write(reinterpret_cast<const char*>(&_buf), 1);
-            _buf = 0;
-            _bits_in_buf = 0;
+        while (_bits_in_buf > 0) {
+            _buf.push_back(static_cast<char>(_bits & 0xFF));
+            _bits >>= 8;
+            _bits_in_buf -= std::min<uint8_t>(_bits_in_buf, 8);
         }
+
+        _file.write(_buf.data(), _buf.size());
+        _buf.clear();
     }
 
-    encoder::encoder(uint32_t width, uint32_t height, uint32_t fps) : _width(width), _height(height), _fps(fps) {
+    encoder::encoder(uint32_t width, uint32_t height, uint32_t fps) : encoder(width, height, fps, options{}) {}
+
+    encoder::encoder(uint32_t width, uint32_t height, uint32_t fps, const options &options)
+    : _spill(options.spill), _threads(std::max<size_t>(options.threads, 1)), _max_code_length(options.max_code_length), _width(width), _height(height), _fps(fps) {
         if (width % 4 != 0 || height % 4 != 0) {
             throw std::invalid_argument("Width and height must be divisible by 4");
         }
+
+        if (_max_code_length == 0 || _max_code_length > std::numeric_limits<bitstream::value_type>::digits) {
+            throw std::invalid_argument(std::format("Maximum code length must be between 1 and {}", std::numeric_limits<bitstream::value_type>::digits));
+        }
     }
 
-    void encoder::encode_frame(const std::span<uint8_t> &frame) {
+    void encoder::encode_frame(const std::span<const uint8_t> &frame) {
         if (frame.size() != _width * _height * 3) {
             throw std::invalid_argument("Frame data does not match width and height");
         }
 
-        _frames.emplace_back(std::move(std::vector<uint8_t>(frame.begin(), frame.end())));
+        std::vector<uint8_t> indices(_width * _height);
+        for (size_t n = 0; n < indices.size(); ++n) {
+            if (n > 0 && std::equal(frame.begin() + n * 3, frame.begin() + n * 3 + 3, frame.begin() + n * 3 - 3)) {
+                indices[n] = indices[n - 1];
+                continue;
+            }
+            indices[n] = _get_color_index(frame[n * 3], frame[n * 3 + 1], frame[n * 3 + 2]);
+        }
+
+        ++_num_frames;
+
+        if (_spill != nullptr) {
+            const auto chains = _encode_chains(indices, _num_frames > 1 ? _last_frame.data() : nullptr);
+            _count_chains(chains);
+            _spill_chains(chains);
+            _last_frame = std::move(indices);
+            return;
+        }
+
+        _frames.emplace_back(std::move(indices));
+    }
+
+    uint8_t encoder::_get_color_index(uint8_t r, uint8_t g, uint8_t b) {
+        const uint32_t key = (1 << 24) | (r << 16) | (g << 8) | b;
+        size_t slot = (key * 2654435761u) >> (32 - std::countr_zero(_color_keys.size()));
+        while (_color_keys[slot] != 0) {
+            if (_color_keys[slot] == key) {
+                return _color_indices[slot];
+            }
+            slot = (slot + 1) % _color_keys.size();
+        }
+
+        _palette[_color_count] = { r, g, b };
+        _color_keys[slot] = key;
+        _color_indices[slot] = _color_count;
+        if (++_color_count >= 256) {
+            throw std::runtime_error("Too many colors");
+        }
+
+        return _color_count - 1;
     }
 
     void encoder::write(std::ostream &file) {
@@ -64,7 +169,7 @@ namespace smk {
 
         write_le<uint32_t>(file, _width);
         write_le<uint32_t>(file, _height);
-        write_le<uint32_t>(file, _frames.size());
+        write_le<uint32_t>(file, _num_frames);
         write_le<uint32_t>(file, 1000 / _fps);
 
         write_le<uint32_t>(file, 0); // flags
@@ -73,234 +178,245 @@ namespace smk {
             write_le<uint32_t>(file, 0); // audio size
         }
 
-        std::ostringstream ss(std::ios::binary);
-        bitstream bs(ss);
-        huffman_tree<uint16_t> type(bs);
-        huffman_tree<uint16_t> mmap(bs);
-        huffman_tree<uint16_t> mclr(bs);
-        huffman_tree<uint16_t> full(bs);
-
-        palette_type palette;
-        size_t color_count = 0;
-        for (const auto &frame : _frames) {
-            for (size_t n = 0; n < frame.size(); n += 3) {
-                bool found = false;
-
-                for (size_t m = 0; m < color_count; ++m) {
-                    if (palette[m][0] == frame[n] && palette[m][1] == frame[n + 1] && palette[m][2] == frame[n + 2]) {
-                        found = true;
-                        break;
-                    }
-                }
+        std::vector<std::vector<chain>> frame_chains(_frames.size());
+        parallel_for(_frames.size(), _threads, [&](size_t n) {
+            frame_chains[n] = _encode_chains(_frames[n], n > 0 ? _frames[n - 1].data() : nullptr);
+        });
+
+        for (const auto &chains : frame_chains) {
+            _count_chains(chains);
+        }
+
+        _mmap.pack();
+        _mclr.pack();
+        _full.pack();
+        _type.pack();
+
+        _bitstream.flush();
+        const auto packed_trees = _buffer.str();
+
+        write_le<uint32_t>(file, packed_trees.size()); // tree sizes
+        write_le<uint32_t>(file, (_mmap.size() * 4) + 12);
+        write_le<uint32_t>(file, (_mclr.size() * 4) + 12);
+        write_le<uint32_t>(file, (_full.size() * 4) + 12);
+        write_le<uint32_t>(file, (_type.size() * 4) + 12);
+
+        for (size_t n = 0; n < 7; ++n) {
+            write_le<uint32_t>(file, 0); // audio rate
+        }
+
+        write_le<uint32_t>(file, 0); // dummy
+
+        if (_spill != nullptr) {
+            const auto frame_sizes_pos = file.tellp();
+            for (size_t n = 0; n < _num_frames; ++n) {
+                write_le<uint32_t>(file, 0); // frame size, patched below
+            }
+
+            for (size_t n = 0; n < _num_frames; ++n) {
+                write_le<uint8_t>(file, n == 0 ? 1 : 0); // frame type (has palette)
+            }
+
+            file.write(packed_trees.data(), packed_trees.size());
 
-                if (!found) {
-                    palette[color_count++] = { frame[n], frame[n + 1], frame[n + 2] };
+            std::vector<uint32_t> frame_sizes;
+            frame_sizes.reserve(_num_frames);
+            _spill->seekg(0);
+            for (size_t first_frame = 0; first_frame < _num_frames; first_frame += _threads) {
+                std::vector<std::vector<chain>> batch;
+                for (size_t n = first_frame; n < std::min<size_t>(first_frame + _threads, _num_frames); ++n) {
+                    batch.emplace_back(_read_spilled_chains());
+                }
 
-                    if (color_count >= 256) {
-                        throw std::runtime_error("Too many colors");
+                const auto batch_data = _pack_frames(batch, first_frame);
+                for (size_t n = 0; n < batch_data.size(); ++n) {
+                    if (first_frame + n == 0) {
+                        _write_palette(file, _palette);
                     }
+                    file.write(batch_data[n].data(), batch_data[n].size());
+                    frame_sizes.emplace_back(batch_data[n].size() + (first_frame + n == 0 ? (256 * 3 + 4) : 0));
                 }
             }
-        }
 
-        const auto get_color_index = [&](uint8_t r, uint8_t g, uint8_t b) {
-            for (size_t n = 0; n < color_count; ++n) {
-                if (palette[n][0] == r && palette[n][1] == g && palette[n][2] == b) {
-                    return n;
-                }
+            const auto end_pos = file.tellp();
+            file.seekp(frame_sizes_pos);
+            for (const auto size : frame_sizes) {
+                write_le<uint32_t>(file, size);
             }
+            file.seekp(end_pos);
+            return;
+        }
 
-            throw std::runtime_error("Color not found");
-        };
+        const auto frame_data = _pack_frames(frame_chains, 0);
+        for (size_t n = 0; n < frame_data.size(); ++n) {
+            write_le<uint32_t>(file, frame_data[n].size() + (n == 0 ? (256 * 3 + 4) : 0)); // last bit indicates keyframe, second last bit is reserved
+        }
 
-        struct chain {
+        for (size_t n = 0; n < _num_frames; ++n) {
+            write_le<uint8_t>(file, n == 0 ? 1 : 0); // frame type (has palette)
+        }
+
+        file.write(packed_trees.data(), packed_trees.size());
+
+        for (size_t n = 0; n < frame_data.size(); ++n) {
+            if (n == 0) {
+                _write_palette(file, _palette);
+            }
+            file.write(frame_data[n].data(), frame_data[n].size());
+        }
+    }
+
+    std::vector<encoder::chain> encoder::_encode_chains(std::span<const uint8_t> frame, const uint8_t *last_frame) const {
+        struct preprocessed_block {
             block_type type;
-            size_t length;
-            uint8_t data;
-            std::vector<block> blocks;
+            block data;
         };
 
-        std::vector<std::vector<chain>> frame_chains;
-        std::vector<uint8_t> last_frame(_width * _height * 3);
-        for (size_t current_frame_index = 0; current_frame_index < _frames.size(); ++current_frame_index) {
-            const auto &frame = _frames[current_frame_index];
-
-            struct preprocessed_block {
-                block_type type;
-                block data;
-            };
-
-            std::vector<preprocessed_block> blocks;
-            for (size_t y = 0; y < _height; y += 4) {
-                for (size_t x = 0; x < _width; x += 4) {
-                    std::vector<std::array<uint8_t, 3>> colors;
-                    colors.reserve(3);
-                    bool same_as_last = current_frame_index > 0;
-                    for (size_t y_off = 0; y_off < 4; ++y_off) {
-                        for (size_t x_off = 0; x_off < 4; ++x_off) {
-                            const size_t p = (y + y_off) * _width * 3 + (x + x_off) * 3;
-                            if (same_as_last && (frame[p] != last_frame[p] || frame[p + 1] != last_frame[p + 1] || frame[p + 2] != last_frame[p + 2])) {
-                                same_as_last = false;
-                            }
+        std::vector<preprocessed_block> blocks;
+        for (size_t y = 0; y < _height; y += 4) {
+            for (size_t x = 0; x < _width; x += 4) {
+                std::array<uint8_t, 3> colors;
+                size_t color_count = 0;
+                bool same_as_last = last_frame != nullptr;
+                for (size_t y_off = 0; y_off < 4; ++y_off) {
+                    for (size_t x_off = 0; x_off < 4; ++x_off) {
+                        const size_t p = (y + y_off) * _width + x + x_off;
+                        if (same_as_last && frame[p] != last_frame[p]) {
+                            same_as_last = false;
+                        }
 
-                            const auto color = std::array{ frame[p], frame[p + 1], frame[p + 2] };
-                            if (colors.size() < 3 && !std::ranges::contains(colors, color)) {
-                                colors.emplace_back(color);
-                            }
+                        if (color_count < colors.size() && !std::ranges::contains(colors | std::views::take(color_count), frame[p])) {
+                            colors[color_count++] = frame[p];
                         }
                     }
+                }
 
-                    assert(colors.size() > 0);
+                assert(color_count > 0);
 
-                    if (same_as_last) {
-                        blocks.emplace_back(preprocessed_block{ block_type::void_, {} });
-                        continue;
-                    }
+                if (same_as_last) {
+                    blocks.emplace_back(preprocessed_block{ block_type::void_, {} });
+                    continue;
+                }
 
-                    if (colors.size() < 2) {
-                        block block;
-                        block.solid.color = get_color_index(colors[0][0], colors[0][1], colors[0][2]);
-                        blocks.emplace_back(preprocessed_block{ block_type::solid, block });
-                    } else if (colors.size() == 2) {
-                        const uint8_t idx_color1 = get_color_index(colors[0][0], colors[0][1], colors[0][2]);
-                        const uint8_t idx_color0 = get_color_index(colors[1][0], colors[1][1], colors[1][2]);
-
-                        uint16_t pixmap = 0;
-                        for (size_t y_off = 0; y_off < 4; ++y_off) {
-                            for (size_t x_off = 0; x_off < 4; ++x_off) {
-                                const size_t bit_index = y_off * 4 + x_off; // 0..15
-                                const size_t p = (y + y_off) * _width * 3 + (x + x_off) * 3;
-
-                                const auto current_color = std::array{ frame[p], frame[p + 1], frame[p + 2] };
-
-                                if (current_color == colors[0]) {
-                                    pixmap |= static_cast<uint16_t>(1) << bit_index;
-                                }
+                if (color_count < 2) {
+                    block block;
+                    block.solid.color = colors[0];
+                    blocks.emplace_back(preprocessed_block{ block_type::solid, block });
+                } else if (color_count == 2) {
+                    uint16_t pixmap = 0;
+                    for (size_t y_off = 0; y_off < 4; ++y_off) {
+                        for (size_t x_off = 0; x_off < 4; ++x_off) {
+                            const size_t bit_index = y_off * 4 + x_off; // 0..15
+                            if (frame[(y + y_off) * _width + x + x_off] == colors[0]) {
+                                pixmap |= static_cast<uint16_t>(1) << bit_index;
                             }
                         }
+                    }
 
-                        block block;
-                        block.mono.colors = static_cast<uint16_t>((idx_color1 << 8) | idx_color0);
-                        block.mono.map = pixmap;
-
-                        blocks.emplace_back(preprocessed_block{ block_type::mono, block });
-                    } else {
-                        block block;
-                        for (size_t y_off = 0; y_off < 4; ++y_off) {
-                            const size_t p = (y + y_off) * _width * 3 + x * 3;
-                            const uint16_t col1 = get_color_index(frame[p], frame[p + 1], frame[p + 2]);
-                            const uint16_t col2 = get_color_index(frame[p + 3], frame[p + 4], frame[p + 5]);
-                            const uint16_t col3 = get_color_index(frame[p + 6], frame[p + 7], frame[p + 8]);
-                            const uint16_t col4 = get_color_index(frame[p + 9], frame[p + 10], frame[p + 11]);
-                            block.full.colors[y_off][0] = (col4 << 8) | col3;
-                            block.full.colors[y_off][1] = (col2 << 8) | col1;
-                        }
+                    block block;
+                    block.mono.colors = static_cast<uint16_t>((colors[0] << 8) | colors[1]);
+                    block.mono.map = pixmap;
 
-                        blocks.emplace_back(preprocessed_block{ block_type::full, block });
+                    blocks.emplace_back(preprocessed_block{ block_type::mono, block });
+                } else {
+                    block block;
+                    for (size_t y_off = 0; y_off < 4; ++y_off) {
+                        const size_t p = (y + y_off) * _width + x;
+                        block.full.colors[y_off][0] = (frame[p + 3] << 8) | frame[p + 2];
+                        block.full.colors[y_off][1] = (frame[p + 1] << 8) | frame[p];
                     }
+
+                    blocks.emplace_back(preprocessed_block{ block_type::full, block });
                 }
             }
+        }
 
-            assert(blocks.size() == _width * _height / 16);
-
-            std::vector<std::vector<preprocessed_block>> rle_blocks;
-            std::vector<preprocessed_block> current_chain;
-            auto flush = [&]{
-                if (current_chain.empty()) return;
-                rle_blocks.emplace_back(std::move(current_chain));
-                current_chain.clear();
-            };
-
-            for (const auto &b : blocks) {
-                if (!current_chain.empty() &&
-                    (b.type != current_chain.front().type ||
-                    (b.type == block_type::solid &&
-                    b.data.solid.color != current_chain.front().data.solid.color))) {
-                    flush();
-                }
-                current_chain.push_back(b);
+        assert(blocks.size() == _width * _height / 16);
+
+        std::vector<std::vector<preprocessed_block>> rle_blocks;
+        std::vector<preprocessed_block> current_chain;
+        auto flush = [&]{
+            if (current_chain.empty()) return;
+            rle_blocks.emplace_back(std::move(current_chain));
+            current_chain.clear();
+        };
+
+        for (const auto &b : blocks) {
+            if (!current_chain.empty() &&
+                (b.type != current_chain.front().type ||
+                (b.type == block_type::solid &&
+                b.data.solid.color != current_chain.front().data.solid.color))) {
+                flush();
             }
-            flush();
-
-            assert(current_chain.size() == 0);
-            assert(std::ranges::fold_left(rle_blocks, 0, [](size_t acc, const auto &c) { return acc + c.size(); }) == blocks.size());
-
-            constexpr std::array<size_t, 64> sizetable = {
-                1,	2,	3,	4,	5,	6,	7,	8,
-                9,	10,	11,	12,	13,	14,	15,	16,
-                17,	18,	19,	20,	21,	22,	23,	24,
-                25,	26,	27,	28,	29,	30,	31,	32,
-                33,	34,	35,	36,	37,	38,	39,	40,
-                41,	42,	43,	44,	45,	46,	47,	48,
-                49,	50,	51,	52,	53,	54,	55,	56,
-                57,	58,	59,	128, 256, 512, 1024, 2048
-            };
-
-            const auto get_sizes = [sizetable](const std::vector<preprocessed_block> &c) {
-                std::vector<size_t> dp(c.size() + 1, std::numeric_limits<size_t>::max());
-                std::vector<size_t> lastSize(c.size() + 1, -1);
-                dp[0] = 0;
-
-                for (size_t n = 0; n < sizetable.size(); ++n) {
-                    const auto size = sizetable[n];
-                    for (size_t m = size; m <= c.size(); ++m) {
-                        if (dp[m - size] + 1 < dp[m]) {
-                            dp[m] = dp[m - size] + 1;
-                            lastSize[m] = n;
-                        }
+            current_chain.push_back(b);
+        }
+        flush();
+
+        assert(current_chain.size() == 0);
+        assert(std::ranges::fold_left(rle_blocks, 0, [](size_t acc, const auto &c) { return acc + c.size(); }) == blocks.size());
+
+        const auto get_sizes = [](const std::vector<preprocessed_block> &c) {
+            std::vector<size_t> dp(c.size() + 1, std::numeric_limits<size_t>::max());
+            std::vector<size_t> lastSize(c.size() + 1, -1);
+            dp[0] = 0;
+
+            for (size_t n = 0; n < sizetable.size(); ++n) {
+                const auto size = sizetable[n];
+                for (size_t m = size; m <= c.size(); ++m) {
+                    if (dp[m - size] + 1 < dp[m]) {
+                        dp[m] = dp[m - size] + 1;
+                        lastSize[m] = n;
                     }
                 }
+            }
 
-                if (lastSize[c.size()] == -1) {
-                    throw std::runtime_error("Block size could not be encoded");
-                }
+            if (lastSize[c.size()] == -1) {
+                throw std::runtime_error("Block size could not be encoded");
+            }
 
-                std::vector<size_t> sizes;
-                auto n = c.size();
-                while (n > 0) {
-                    sizes.emplace_back(lastSize[n]);
-                    n -= sizetable[lastSize[n]];
-                }
+            std::vector<size_t> sizes;
+            auto n = c.size();
+            while (n > 0) {
+                sizes.emplace_back(lastSize[n]);
+                n -= sizetable[lastSize[n]];
+            }
 
-                return sizes;
-            };
-
-            std::vector<chain> chains;
-            for (const auto &c : rle_blocks) {
-                const auto sizes = get_sizes(c);
-                size_t skip = 0;
-                for (const auto &size : sizes) {
-                    std::vector<block> blocks;
-                    if (c.front().type == block_type::full || c.front().type == block_type::mono) {
-                        blocks.reserve(sizetable[size]);
-                        for (size_t n = skip; n < skip + sizetable[size]; ++n) {
-                            blocks.emplace_back(c[n].data);
-                        }
-                        skip += blocks.size();
+            return sizes;
+        };
+
+        std::vector<chain> chains;
+        for (const auto &c : rle_blocks) {
+            const auto sizes = get_sizes(c);
+            size_t skip = 0;
+            for (const auto &size : sizes) {
+                std::vector<block> blocks;
+                if (c.front().type == block_type::full || c.front().type == block_type::mono) {
+                    blocks.reserve(sizetable[size]);
+                    for (size_t n = skip; n < skip + sizetable[size]; ++n) {
+                        blocks.emplace_back(c[n].data);
                     }
-                    chains.emplace_back(chain{
-                        .type = c.front().type,
-                        .length = size,
-                        .data = static_cast<uint8_t>(c.front().type == block_type::solid ? c.front().data.solid.color : 0),
-                        .blocks = std::move(blocks),
-                    });
+                    skip += blocks.size();
                 }
+                chains.emplace_back(chain{
+                    .type = c.front().type,
+                    .length = size,
+                    .data = static_cast<uint8_t>(c.front().type == block_type::solid ? c.front().data.solid.color : 0),
+                    .blocks = std::move(blocks),
+                });
             }
+        }
 
-            assert(std::ranges::fold_left(chains, 0, [sizetable](size_t acc, const auto &c) { return acc + sizetable[c.length]; }) == blocks.size());
-            assert(std::ranges::fold_left(chains, 0, [sizetable](size_t acc, const auto &c) { return acc + (c.blocks.empty() ? sizetable[c.length] : c.blocks.size()); }) == blocks.size());
-
-            frame_chains.emplace_back(std::move(chains));
+        assert(std::ranges::fold_left(chains, 0, [](size_t acc, const auto &c) { return acc + sizetable[c.length]; }) == blocks.size());
+        assert(std::ranges::fold_left(chains, 0, [](size_t acc, const auto &c) { return acc + (c.blocks.empty() ? sizetable[c.length] : c.blocks.size()); }) == blocks.size());
 
-            std::ranges::copy(frame, last_frame.begin());
-        }
+        return chains;
+    }
 
-        const auto write_chains = [&](const std::vector<chain> &chains, huffman_tree<uint16_t> &type, huffman_tree<uint16_t> &mmap, huffman_tree<uint16_t> &mclr, huffman_tree<uint16_t> &full) {
-            for (const auto &chain : chains) {
+    template <typename F>
+    void encoder::_write_chains(const std::vector<chain> &chains, const F &write) {
+        for (const auto &chain : chains) {
             const uint16_t type_data = static_cast<uint16_t>(chain.type) | (chain.length << 2) | (chain.data << 8);
-            type.write(type_data);
-
-            // std::cout << std::format("Type: {}, Length: {}, Data: {:x}", static_cast<uint16_t>(chain.type), chain.length, chain.data) << std::endl;
+            write(_type, type_data);
 
             switch (chain.type) {
                 case block_type::solid:
@@ -309,74 +425,99 @@ namespace smk {
                 case block_type::full:
                     for (const auto &block : chain.blocks) {
                         for (size_t n = 0; n < 4; ++n) {
-                            full.write(block.full.colors[n][0]);
-                            full.write(block.full.colors[n][1]);
+                            write(_full, block.full.colors[n][0]);
+                            write(_full, block.full.colors[n][1]);
                         }
                     }
                     break;
                 case block_type::mono:
                     for (const auto &block : chain.blocks) {
-                        mclr.write(block.mono.colors);
-                        mmap.write(block.mono.map);
+                        write(_mclr, block.mono.colors);
+                        write(_mmap, block.mono.map);
                     }
                     break;
                 default:
                     throw std::runtime_error(std::format("Unsupported chain type: {}", static_cast<uint8_t>(chain.type)));
             }
         }
-        };
-
-        for (const auto &chains : frame_chains) {
-            write_chains(chains, type, mmap, mclr, full);
-        }
+    }
 
-        mmap.pack();
-        mclr.pack();
-        full.pack();
-        type.pack();
+    void encoder::_count_chains(const std::vector<chain> &chains) {
+        _write_chains(chains, [](huffman_tree<uint16_t> &tree, uint16_t value) {
+            tree.write(value);
+        });
+    }
 
+    std::string encoder::_pack_frame(const std::vector<chain> &chains, bool has_palette) {
+        std::ostringstream ss(std::ios::binary);
+        bitstream bs(ss);
+        _write_chains(chains, [&bs](const huffman_tree<uint16_t> &tree, uint16_t value) {
+            tree.write(bs, value);
+        });
         bs.flush();
-        const auto packed_trees = ss.str();
 
-        write_le<uint32_t>(file, packed_trees.size()); // tree sizes
-        write_le<uint32_t>(file, (mmap.size() * 4) + 12);
-        write_le<uint32_t>(file, (mclr.size() * 4) + 12);
-        write_le<uint32_t>(file, (full.size() * 4) + 12);
-        write_le<uint32_t>(file, (type.size() * 4) + 12);
-
-        for (size_t n = 0; n < 7; ++n) {
-            write_le<uint32_t>(file, 0); // audio rate
-        }
+        auto data = ss.str();
+        const size_t frame_size = data.size() + (has_palette ? (256 * 3 + 4) : 0);
+        data.append((4 - (frame_size % 4)) % 4, '\0');
+        return data;
+    }
 
-        write_le<uint32_t>(file, 0); // dummy
+    std::vector<std::string> encoder::_pack_frames(const std::vector<std::vector<chain>> &frame_chains, size_t first_frame) {
+        std::vector<std::string> frame_data(frame_chains.size());
+        parallel_for(frame_chains.size(), _threads, [&](size_t n) {
+            frame_data[n] = _pack_frame(frame_chains[n], first_frame + n == 0);
+        });
+        return frame_data;
+    }
 
-        std::vector<std::string> frame_data;
-        frame_data.reserve(frame_chains.size());
-        for (size_t n = 0; n < frame_chains.size(); ++n) {
-            const auto &chains = frame_chains[n];
-            ss.str("");
-            write_chains(chains, type, mmap, mclr, full);
-            bs.flush();
-            auto data = ss.str();
-            const size_t frame_size = (data.size() + (n == 0 ? (256 * 3 + 4) : 0));
-            const size_t padding = (4 - (frame_size % 4)) % 4;
-            data.append(padding, '\0');
-            frame_data.emplace_back(data);
-            write_le<uint32_t>(file, frame_size + padding); // last bit indicates keyframe, second last bit is reserved
+    void encoder::_spill_chains(const std::vector<chain> &chains) {
+        write_le<uint32_t>(*_spill, chains.size());
+        for (const auto &chain : chains) {
+            write_le<uint16_t>(*_spill, static_cast<uint16_t>(chain.type) | (chain.length << 2) | (chain.data << 8));
+            for (const auto &block : chain.blocks) {
+                if (chain.type == block_type::full) {
+                    for (size_t n = 0; n < 4; ++n) {
+                        write_le<uint16_t>(*_spill, block.full.colors[n][0]);
+                        write_le<uint16_t>(*_spill, block.full.colors[n][1]);
+                    }
+                } else {
+                    write_le<uint16_t>(*_spill, block.mono.colors);
+                    write_le<uint16_t>(*_spill, block.mono.map);
+                }
+            }
         }
+    }
 
-        for (size_t n = 0; n < _frames.size(); ++n) {
-            write_le<uint8_t>(file, n == 0 ? 1 : 0); // frame type (has palette)
-        }
+    std::vector<encoder::chain> encoder::_read_spilled_chains() {
+        std::vector<chain> chains(read_le<uint32_t>(*_spill));
+        for (auto &chain : chains) {
+            const auto type_data = read_le<uint16_t>(*_spill);
+            chain.type = static_cast<block_type>(type_data & 0x03);
+            chain.length = (type_data >> 2) & 0x3F;
+            chain.data = type_data >> 8;
 
-        file.write(packed_trees.data(), packed_trees.size());
+            if (chain.type == block_type::full || chain.type == block_type::mono) {
+                chain.blocks.resize(sizetable[chain.length]);
+            }
 
-        for (size_t n = 0; n < frame_data.size(); ++n) {
-            if (n == 0) {
-                _write_palette(file, palette);
+            for (auto &block : chain.blocks) {
+                if (chain.type == block_type::full) {
+                    for (size_t n = 0; n < 4; ++n) {
+                        block.full.colors[n][0] = read_le<uint16_t>(*_spill);
+                        block.full.colors[n][1] = read_le<uint16_t>(*_spill);
+                    }
+                } else {
+                    block.mono.colors = read_le<uint16_t>(*_spill);
+                    block.mono.map = read_le<uint16_t>(*_spill);
+                }
             }
-            file.write(frame_data[n].data(), frame_data[n].size());
         }
+
+        if (!*_spill) {
+            throw std::runtime_error("Could not read spill file");
+        }
+
+        return chains;
     }
 
     void encoder::_write_palette(std::ostream &file, const palette_type &palette) {
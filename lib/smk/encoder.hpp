@@ -1,6 +1,7 @@
 #pragma once
 
 #include <cstdint>
+#include <istream>
 #include <ostream>
 #include <span>
 #include <vector>
@@ -11,18 +12,31 @@
 #include <cassert>
 #include <iterator>
 #include <ranges>
-#include <memory>
-#include <optional>
 #include <array>
 #include <climits>
-#include <functional>
+#include <limits>
+#include <numeric>
+#include <format>
+#include <stdexcept>
+#include <sstream>
+#include <string>
 
 namespace smk {
     class encoder {
     public:
+        struct options {
+            // classified frames are spilled here instead of being buffered, write() then needs a seekable output
+            std::iostream *spill = nullptr;
+            // worker threads used to classify buffered frames
+            size_t threads = 1;
+            // longest huffman code, lets decoders resolve every symbol with one or two table lookups
+            uint8_t max_code_length = 32;
+        };
+
         explicit encoder(uint32_t width, uint32_t height, uint32_t fps);
+        explicit encoder(uint32_t width, uint32_t height, uint32_t fps, const options &options);
 
-        void encode_frame(const std::span<uint8_t> &frame);
+        void encode_frame(const std::span<const uint8_t> &frame);
         void write(std::ostream &file);
 
     private:
@@ -36,7 +50,8 @@ namespace smk {
 
         private:
             std::ostream &_file;
-            uint8_t _buf = 0;
+            std::string _buf;
+            uint64_t _bits = 0;
             uint8_t _bits_in_buf = 0;
         };
 
@@ -47,33 +62,139 @@ namespace smk {
 
         private:
             constexpr static bool is_huff16 = std::numeric_limits<symbol_type>::digits >= 16;
+            constexpr static size_t symbol_count = size_t{1} << (sizeof(symbol_type) * CHAR_BIT);
+
+            static size_t index(symbol_type value) {
+                return static_cast<std::make_unsigned_t<symbol_type>>(value);
+            }
 
             bitstream &_bitstream;
-            std::map<symbol_type, size_t> _symbol_freq;
+            uint8_t _max_code_length;
+            std::vector<size_t> _symbol_freq = std::vector<size_t>(symbol_count);
             std::array<symbol_type, 3> _escape_values;
+            size_t _leaf_count = 0;
 
             struct code_type {
-                bitstream::value_type word;
-                size_t length;
+                constexpr static uint8_t none = std::numeric_limits<uint8_t>::max();
+
+                bitstream::value_type word = 0;
+                uint8_t length = none;
+            };
+
+            constexpr static uint32_t leaf = std::numeric_limits<uint32_t>::max();
+            struct node {
+                size_t freq;
+                uint32_t zero;
+                uint32_t one;
+                symbol_type symbol;
             };
 
+            // package-merge: optimal code lengths for leaves sorted by frequency, none longer than max_length
+            static std::vector<uint8_t> limited_lengths(const std::vector<node> &leaves, uint8_t max_length) {
+                const size_t count = leaves.size();
+                if (count > (uint64_t{1} << max_length)) {
+                    throw std::runtime_error(std::format("{} symbols do not fit into codes of {} bits", count, max_length));
+                }
+
+                std::vector<std::vector<int32_t>> levels{ std::vector<int32_t>(count) };
+                std::vector<size_t> weights(count);
+                for (size_t n = 0; n < count; ++n) {
+                    levels[0][n] = n;
+                    weights[n] = leaves[n].freq;
+                }
+
+                for (size_t level = 1; level < max_length; ++level) {
+                    std::vector<int32_t> items;
+                    std::vector<size_t> merged;
+                    items.reserve(count + weights.size() / 2);
+                    merged.reserve(count + weights.size() / 2);
+
+                    size_t next_leaf = 0;
+                    size_t next_package = 0;
+                    while (next_leaf < count || next_package + 1 < weights.size()) {
+                        const auto package = next_package + 1 < weights.size() ? weights[next_package] + weights[next_package + 1] : std::numeric_limits<size_t>::max();
+                        if (next_leaf < count && leaves[next_leaf].freq <= package) {
+                            items.emplace_back(next_leaf);
+                            merged.emplace_back(leaves[next_leaf++].freq);
+                        } else {
+                            items.emplace_back(-1);
+                            merged.emplace_back(package);
+                            next_package += 2;
+                        }
+                    }
+
+                    levels.emplace_back(std::move(items));
+                    weights = std::move(merged);
+                }
+
+                std::vector<uint8_t> lengths(count);
+                size_t selected = 2 * count - 2;
+                for (auto level = levels.rbegin(); level != levels.rend(); ++level) {
+                    size_t packages = 0;
+                    for (size_t n = 0; n < selected; ++n) {
+                        if ((*level)[n] < 0) {
+                            ++packages;
+                        } else {
+                            ++lengths[(*level)[n]];
+                        }
+                    }
+                    selected = 2 * packages;
+                }
+
+                return lengths;
+            }
+
+            // canonical tree for the given code lengths, the root is the first node
+            static std::vector<node> canonical_tree(const std::vector<node> &leaves, const std::vector<uint8_t> &lengths) {
+                std::vector<uint32_t> order(leaves.size());
+                std::iota(order.begin(), order.end(), 0);
+                std::ranges::stable_sort(order, {}, [&lengths](uint32_t n) { return lengths[n]; });
+
+                std::vector<node> nodes{ node{ 0, 0, 0, {} } };
+                nodes.reserve(2 * leaves.size() - 1);
+                uint64_t code = 0;
+                uint8_t length = lengths[order.front()];
+                for (const auto n : order) {
+                    code <<= lengths[n] - length;
+                    length = lengths[n];
+
+                    uint32_t current = 0;
+                    for (size_t bit = length; bit-- > 0;) {
+                        auto &child = (code >> bit) & 1 ? nodes[current].one : nodes[current].zero;
+                        if (child == 0) {
+                            child = nodes.size();
+                            nodes.emplace_back(bit == 0 ? leaves[n] : node{ 0, 0, 0, {} });
+                        }
+                        current = child;
+                    }
+
+                    ++code;
+                }
+
+                return nodes;
+            }
+
         public:
-            std::map<symbol_type, code_type> _huff_table;
-            huffman_tree(bitstream &bitstream) : _bitstream(bitstream) {}
+            std::vector<code_type> _huff_table;
+            huffman_tree(bitstream &bitstream, uint8_t max_code_length = std::numeric_limits<bitstream::value_type>::digits)
+                : _bitstream(bitstream), _max_code_length(max_code_length) {}
 
             void write(symbol_type value) {
                 if (_huff_table.empty()) {
-                    ++_symbol_freq[value];
+                    ++_symbol_freq[index(value)];
                     return;
                 }
 
-                const auto it = _huff_table.find(value);
-                if (it == _huff_table.end()) {
+                write(_bitstream, value);
+            }
+
+            void write(bitstream &target, symbol_type value) const {
+                const auto &code = _huff_table[index(value)];
+                if (code.length == code_type::none) {
                     throw std::runtime_error("symbol not found in huffman table");
                 }
 
-                const auto &code = it->second;
-                _bitstream.write(code.word, code.length);
+                target.write(code.word, code.length);
             }
 
             void pack() {
@@ -81,27 +202,10 @@ namespace smk {
                     throw std::runtime_error("tree already built");
                 }
 
-                struct node {
-                    std::unique_ptr<node> zero;
-                    std::unique_ptr<node> one;
-                    std::optional<symbol_type> symbol;
-                    size_t freq;
-                };
-
-                const std::function<void(node*, code_type)> build_huff_table = [this, &build_huff_table](node* node, code_type code) {
-                    if (node->symbol.has_value()) {
-                        _huff_table[node->symbol.value()] = code;
-                        return;
-                    }
-
-                    build_huff_table(node->zero.get(), code_type{ static_cast<bitstream::value_type>(code.word), code.length + 1 });
-                    build_huff_table(node->one.get(), code_type{ static_cast<bitstream::value_type>(code.word | (1 << code.length)), code.length + 1 });
-                };
-
                 if constexpr (is_huff16) {
                     size_t n = 0;
                     for (uint16_t symbol = 1; symbol != 0 && n < _escape_values.size(); ++symbol) {
-                        if (!_symbol_freq.contains(symbol)) {
+                        if (_symbol_freq[symbol] == 0) {
                             _escape_values[n++] = symbol;
                         }
                     }
@@ -111,69 +215,114 @@ namespace smk {
                     }
                 }
 
-                std::vector<std::unique_ptr<node>> queue;
-                queue.reserve(_symbol_freq.size());
-                std::ranges::transform(_symbol_freq, std::back_inserter(queue), [](const auto &pair) {
-                    return std::make_unique<node>(node{ nullptr, nullptr, pair.first, pair.second });
-                });
+                std::vector<node> nodes;
+                size_t total_freq = 0;
+                for (size_t n = 0; n < symbol_count; ++n) {
+                    if (_symbol_freq[n] > 0) {
+                        nodes.emplace_back(node{ _symbol_freq[n], leaf, leaf, static_cast<symbol_type>(n) });
+                        total_freq += _symbol_freq[n];
+                    }
+                }
 
+                // escape values are never emitted, they are weighted above any group of real symbols to stay next to the root
                 if constexpr (is_huff16) {
                     for (size_t n = 0; n < _escape_values.size(); ++n) {
-                        queue.emplace_back(std::make_unique<node>(node{ nullptr, nullptr, _escape_values[n], std::numeric_limits<size_t>::max() }));
+                        nodes.emplace_back(node{ total_freq + 1, leaf, leaf, _escape_values[n] });
                     }
                 }
 
-                while (queue.size() > 1) {
-                    std::ranges::sort(queue, [](const auto &a, const auto &b) {
-                        return a->freq > b->freq;
-                    });
-
-                    auto left = std::move(queue.back());
-                    queue.pop_back();
-                    auto right = std::move(queue.back());
-                    queue.pop_back();
-
-                    const auto freq = left->freq + right->freq;
-                    queue.emplace_back(std::make_unique<node>(node{
-                        .zero = std::move(left),
-                        .one = std::move(right),
-                        .symbol = {},
-                        .freq = freq,
-                    }));
-                }
-
-                assert(queue.size() == 1);
-                std::unique_ptr<node> root = std::move(queue.back());
-                build_huff_table(root.get(), {});
-
-                const std::function<void(const node*, huffman_tree<uint8_t>*, huffman_tree<uint8_t>*)> pack_tree_structure =
-                    [this, &pack_tree_structure](const node* node, huffman_tree<uint8_t>* high_byte_tree, huffman_tree<uint8_t>* low_byte_tree) {
-                    if (!node->symbol.has_value()) {
-                        _bitstream.write(0b1, 1);
-                        pack_tree_structure(node->zero.get(), high_byte_tree, low_byte_tree);
-                        pack_tree_structure(node->one.get(), high_byte_tree, low_byte_tree);
-                        return;
+                assert(!nodes.empty());
+                nodes.reserve(2 * nodes.size() - 1);
+
+                // two-queue merge: sorted leaves and internal nodes, which are created in ascending order of frequency
+                std::ranges::stable_sort(nodes, {}, &node::freq);
+                const size_t leaf_count = nodes.size();
+                size_t next_leaf = 0;
+                size_t next_internal = leaf_count;
+                const auto pop_smallest = [&]() -> uint32_t {
+                    if (next_leaf < leaf_count && (next_internal == nodes.size() || nodes[next_leaf].freq <= nodes[next_internal].freq)) {
+                        return next_leaf++;
                     }
+                    return next_internal++;
+                };
+
+                std::vector<size_t> depths(2 * leaf_count - 1);
+                size_t max_depth = 0;
+                for (size_t n = 1; n < leaf_count; ++n) {
+                    const auto zero = pop_smallest();
+                    const auto one = pop_smallest();
+                    nodes.emplace_back(node{ nodes[zero].freq + nodes[one].freq, zero, one, {} });
+                }
+
+                uint32_t root = nodes.size() - 1;
+                for (size_t n = nodes.size(); n-- > leaf_count;) {
+                    depths[nodes[n].zero] = depths[nodes[n].one] = depths[n] + 1;
+                    max_depth = std::max(max_depth, depths[n] + 1);
+                }
+
+                if (max_depth > _max_code_length) {
+                    nodes.resize(leaf_count);
+                    nodes = canonical_tree(nodes, limited_lengths(nodes, _max_code_length));
+                    root = 0;
+                }
+
+                _huff_table.resize(symbol_count);
 
-                    _bitstream.write(0b0, 1);
+                std::vector<std::pair<uint32_t, code_type>> stack{ { root, code_type{ 0, 0 } } };
+                while (!stack.empty()) {
+                    const auto [n, code] = stack.back();
+                    stack.pop_back();
 
-                    if constexpr (is_huff16) {
-                        low_byte_tree->write(node->symbol.value() & 0xFF);
-                        high_byte_tree->write(node->symbol.value() >> 8);
-                    } else {
-                        _bitstream.write(node->symbol.value(), sizeof(symbol_type) * CHAR_BIT);
+                    if (nodes[n].zero == leaf) {
+                        _huff_table[index(nodes[n].symbol)] = code;
+                        ++_leaf_count;
+                        continue;
+                    }
+
+                    if (code.length >= std::numeric_limits<bitstream::value_type>::digits) {
+                        throw std::runtime_error("huffman code exceeds bitstream word");
+                    }
+
+                    const auto length = static_cast<uint8_t>(code.length + 1);
+                    stack.emplace_back(nodes[n].one, code_type{ code.word | (bitstream::value_type{1} << code.length), length });
+                    stack.emplace_back(nodes[n].zero, code_type{ code.word, length });
+                }
+
+                const auto pack_tree_structure = [this, &nodes, root](huffman_tree<uint8_t>* high_byte_tree, huffman_tree<uint8_t>* low_byte_tree) {
+                    std::vector<uint32_t> stack{ root };
+                    while (!stack.empty()) {
+                        const auto &node = nodes[stack.back()];
+                        stack.pop_back();
+
+                        if (node.zero != leaf) {
+                            _bitstream.write(0b1, 1);
+                            stack.emplace_back(node.one);
+                            stack.emplace_back(node.zero);
+                            continue;
+                        }
+
+                        _bitstream.write(0b0, 1);
+
+                        if constexpr (is_huff16) {
+                            low_byte_tree->write(node.symbol & 0xFF);
+                            high_byte_tree->write(node.symbol >> 8);
+                        } else {
+                            _bitstream.write(node.symbol, sizeof(symbol_type) * CHAR_BIT);
+                        }
                     }
                 };
 
                 _bitstream.write(0b1, 1);
 
                 if constexpr (is_huff16) {
-                    huffman_tree<uint8_t> low_byte_tree(_bitstream);
-                    huffman_tree<uint8_t> high_byte_tree(_bitstream);
+                    huffman_tree<uint8_t> low_byte_tree(_bitstream, _max_code_length);
+                    huffman_tree<uint8_t> high_byte_tree(_bitstream, _max_code_length);
 
-                    for (const auto &symbol : _huff_table) {
-                        low_byte_tree.write(symbol.first & 0xFF);
-                        high_byte_tree.write(symbol.first >> 8);
+                    for (size_t n = 0; n < symbol_count; ++n) {
+                        if (_huff_table[n].length != code_type::none) {
+                            low_byte_tree.write(n & 0xFF);
+                            high_byte_tree.write(n >> 8);
+                        }
                     }
 
                     low_byte_tree.pack();
@@ -183,16 +332,16 @@ namespace smk {
                         _bitstream.write(_escape_values[n], sizeof(typename decltype(_escape_values)::value_type) * CHAR_BIT);
                     }
 
-                    pack_tree_structure(root.get(), &high_byte_tree, &low_byte_tree);
+                    pack_tree_structure(&high_byte_tree, &low_byte_tree);
                 } else {
-                    pack_tree_structure(root.get(), nullptr, nullptr);
+                    pack_tree_structure(nullptr, nullptr);
                 }
 
                 _bitstream.write(0b0, 1);
             }
 
             size_t size() const {
-                return 2 * _huff_table.size() - 1;
+                return 2 * _leaf_count - 1;
             }
         };
 
@@ -219,10 +368,44 @@ namespace smk {
             } full;
         };
 
+        struct chain {
+            block_type type;
+            size_t length;
+            uint8_t data;
+            std::vector<block> blocks;
+        };
+
+        std::vector<chain> _encode_chains(std::span<const uint8_t> frame, const uint8_t *last_frame) const;
+        template <typename F>
+        void _write_chains(const std::vector<chain> &chains, const F &write);
+        void _count_chains(const std::vector<chain> &chains);
+        std::string _pack_frame(const std::vector<chain> &chains, bool has_palette);
+        void _spill_chains(const std::vector<chain> &chains);
+        std::vector<chain> _read_spilled_chains();
+        std::vector<std::string> _pack_frames(const std::vector<std::vector<chain>> &frame_chains, size_t first_frame);
+
+        palette_type _palette{};
+        size_t _color_count = 0;
+        std::array<uint32_t, 1024> _color_keys{}; // open addressing over 0x01RRGGBB keys, 0 marks a free slot
+        std::array<uint8_t, 1024> _color_indices;
+        uint8_t _get_color_index(uint8_t r, uint8_t g, uint8_t b);
+
         std::vector<std::vector<uint8_t>> _frames;
+        std::vector<uint8_t> _last_frame;
+        size_t _num_frames = 0;
+        std::iostream *_spill;
+        size_t _threads;
+        uint8_t _max_code_length;
 
         uint32_t _width;
         uint32_t _height;
         uint32_t _fps;
+
+        std::ostringstream _buffer{std::ios::binary};
+        bitstream _bitstream{_buffer};
+        huffman_tree<uint16_t> _type{_bitstream, _max_code_length};
+        huffman_tree<uint16_t> _mmap{_bitstream, _max_code_length};
+        huffman_tree<uint16_t> _mclr{_bitstream, _max_code_length};
+        huffman_tree<uint16_t> _full{_bitstream, _max_code_length};
     };
 }
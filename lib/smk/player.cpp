@@ -0,0 +1,170 @@
+#include "player.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <format>
+#include <stdexcept>
+#include <thread>
+
+namespace smk {
+    player::player(decoder &decoder, sink &sink) : player(decoder, sink, options{}) {}
+
+    player::player(decoder &decoder, sink &sink, const options &options)
+    : _decoder(decoder), _sink(sink), _options(options), _stride(decoder.width() * decoder::bytes_per_pixel(options.format)) {
+        if (!(_options.speed > 0)) {
+            throw std::runtime_error(std::format("Invalid playback speed: {}", _options.speed));
+        }
+
+        _ring.resize(std::max<size_t>(_options.ring_size, 1));
+        for (auto &slot : _ring) {
+            slot.pixels.resize(_stride * decoder.height());
+        }
+    }
+
+    void player::stop() {
+        {
+            std::scoped_lock lock(_mutex);
+            _stopped = true;
+        }
+        _ready.notify_all();
+        _free.notify_all();
+    }
+
+    void player::_decode_ahead() {
+        try {
+            for (size_t frame = _decoder.current_frame(); frame < _decoder.num_frames(); ++frame) {
+                slot *target;
+                {
+                    std::unique_lock lock(_mutex);
+                    _free.wait(lock, [&] { return _stopped || _count < _ring.size(); });
+                    if (_stopped) {
+                        break;
+                    }
+                    target = &_ring[(_head + _count) % _ring.size()];
+                }
+
+                const auto start = std::chrono::steady_clock::now();
+                _decoder.decode_frame({ target->pixels.data(), _stride, _options.format });
+                target->decode_time = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+                target->frame = frame;
+
+                {
+                    std::scoped_lock lock(_mutex);
+                    ++_count;
+                }
+                _ready.notify_one();
+            }
+        } catch (...) {
+            std::scoped_lock lock(_mutex);
+            _error = std::current_exception();
+        }
+
+        {
+            std::scoped_lock lock(_mutex);
+            _finished = true;
+        }
+        _ready.notify_one();
+    }
+
+    player::statistics player::play() {
+        _head = 0;
+        _count = 0;
+        _finished = false;
+        _stopped = false;
+        _error = nullptr;
+
+        const auto first = _decoder.current_frame();
+        const auto frame_duration = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double, std::micro>(_decoder.frame_duration().count() / _options.speed));
+
+        statistics stats;
+        stats.min_occupancy = _ring.size();
+        std::vector<std::chrono::microseconds> decode_times;
+        size_t occupancy = 0;
+
+        {
+            std::jthread worker([this] { _decode_ahead(); });
+
+            try {
+                // fill the ring before the clock starts, so the first frames are not late because of startup
+                {
+                    std::unique_lock lock(_mutex);
+                    _ready.wait(lock, [&] { return _stopped || _finished || _count == _ring.size(); });
+                }
+
+                const auto start = std::chrono::steady_clock::now();
+                while (true) {
+                    slot *current;
+                    {
+                        std::unique_lock lock(_mutex);
+                        _ready.wait(lock, [&] { return _stopped || _finished || _count > 0; });
+                        if (_stopped || _count == 0) {
+                            break;
+                        }
+                        current = &_ring[_head];
+                    }
+
+                    const auto due = start + (current->frame - first) * frame_duration;
+                    const auto ready = std::chrono::steady_clock::now();
+                    if (ready > due) {
+                        ++stats.underruns;
+                    }
+                    std::this_thread::sleep_until(due);
+
+                    {
+                        std::scoped_lock lock(_mutex);
+                        occupancy += _count;
+                        stats.min_occupancy = std::min(stats.min_occupancy, _count);
+                    }
+                    decode_times.push_back(current->decode_time);
+
+                    // a frame whose successor is already due would only be on screen for an instant
+                    const auto now = std::chrono::steady_clock::now();
+                    if (now >= due + frame_duration && current->frame + 1 < _decoder.num_frames()) {
+                        ++stats.dropped;
+                    } else {
+                        if (now - due > _options.late_threshold) {
+                            ++stats.late;
+                        }
+                        _sink.present(current->frame, current->pixels, _stride);
+                        ++stats.presented;
+                    }
+
+                    {
+                        std::scoped_lock lock(_mutex);
+                        _head = (_head + 1) % _ring.size();
+                        --_count;
+                    }
+                    _free.notify_one();
+                }
+            } catch (...) {
+                stop();
+                throw;
+            }
+
+            stop();
+        }
+
+        if (_error) {
+            std::rethrow_exception(_error);
+        }
+
+        if (!decode_times.empty()) {
+            std::ranges::sort(decode_times);
+            stats.decode_p50 = _percentile(decode_times, 0.50);
+            stats.decode_p95 = _percentile(decode_times, 0.95);
+            stats.decode_p99 = _percentile(decode_times, 0.99);
+            stats.decode_max = decode_times.back();
+            stats.average_occupancy = static_cast<double>(occupancy) / decode_times.size();
+        } else {
+            stats.min_occupancy = 0;
+        }
+
+        return stats;
+    }
+
+    // nearest rank
+    std::chrono::microseconds player::_percentile(const std::vector<std::chrono::microseconds> &sorted, double percentile) {
+        const auto rank = static_cast<size_t>(std::ceil(percentile * sorted.size()));
+        return sorted[std::clamp<size_t>(rank, 1, sorted.size()) - 1];
+    }
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cstdint>
+#include <chrono>
+#include <span>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+
+#include "decoder.hpp"
+
+namespace smk {
+    // receives frames from the player when they are due
+    class sink {
+    public:
+        virtual ~sink() = default;
+
+        // pixels stay valid until present() returns
+        virtual void present(size_t frame, std::span<const uint8_t> pixels, size_t stride) = 0;
+    };
+
+    // throws every frame away, for measuring decoding headroom without a display
+    class null_sink : public sink {
+    public:
+        void present(size_t, std::span<const uint8_t>, size_t) override {}
+    };
+
+    // paces decoded frames against the decoder's frame duration on a monotonic clock, while a background
+    // thread decodes ahead into a ring of frames
+    class player {
+    public:
+        struct options {
+            // frames decoded ahead of the one being shown
+            size_t ring_size = 4;
+            decoder::pixel_format format = decoder::pixel_format::rgb24;
+            // playback speed, e.g. 2 presents frames twice as fast to check for headroom
+            double speed = 1.0;
+            // presenting later than this after the due time counts as late
+            std::chrono::microseconds late_threshold = std::chrono::milliseconds(2);
+        };
+
+        struct statistics {
+            size_t presented = 0;
+            // presented, but more than late_threshold after the due time
+            size_t late = 0;
+            // skipped because the next frame was already due when they became ready
+            size_t dropped = 0;
+
+            std::chrono::microseconds decode_p50{0};
+            std::chrono::microseconds decode_p95{0};
+            std::chrono::microseconds decode_p99{0};
+            std::chrono::microseconds decode_max{0};
+
+            // decoded frames waiting in the ring whenever a frame was due
+            double average_occupancy = 0;
+            size_t min_occupancy = 0;
+            // times the ring was empty when a frame was due
+            size_t underruns = 0;
+        };
+
+        explicit player(decoder &decoder, sink &sink);
+        explicit player(decoder &decoder, sink &sink, const options &options);
+
+        // plays from the decoder's current frame to the end or until stop() and blocks until then
+        statistics play();
+        // safe to call from any thread, including from inside present()
+        void stop();
+
+    private:
+        struct slot {
+            std::vector<uint8_t> pixels;
+            size_t frame;
+            std::chrono::microseconds decode_time;
+        };
+
+        void _decode_ahead();
+        static std::chrono::microseconds _percentile(const std::vector<std::chrono::microseconds> &sorted, double percentile);
+
+        decoder &_decoder;
+        sink &_sink;
+        options _options;
+        size_t _stride;
+
+        std::vector<slot> _ring;
+        size_t _head = 0;
+        size_t _count = 0;
+        bool _finished = false;
+        std::atomic<bool> _stopped = false;
+        std::exception_ptr _error;
+        std::mutex _mutex;
+        std::condition_variable _ready;
+        std::condition_variable _free;
+    };
+}
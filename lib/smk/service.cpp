@@ -0,0 +1,228 @@
+#include "service.hpp"
+
+#include <algorithm>
+#include <format>
+#include <stdexcept>
+
+namespace smk {
+    // heap order for the task queues, earliest deadline on top
+    constexpr auto later = [](const auto &a, const auto &b) {
+        return a.deadline > b.deadline;
+    };
+
+    service::service() : service(options{}) {}
+
+    service::service(const options &options) {
+        const size_t threads = std::max<size_t>(options.threads, 1);
+        for (size_t n = 0; n < threads; ++n) {
+            _queues.emplace_back(std::make_unique<worker_queue>());
+        }
+        for (size_t n = 0; n < threads; ++n) {
+            _workers.emplace_back([this, n] { _work(n); });
+        }
+    }
+
+    service::~service() {
+        {
+            std::scoped_lock lock(_mutex);
+            _stopping = true;
+        }
+        _work_available.notify_all();
+        _workers.clear();
+    }
+
+    service::stream_id service::open(std::unique_ptr<io::input> input, const stream_options &options) {
+        auto created = std::make_unique<stream>();
+        created->input = std::move(input);
+        // decoding is spread over streams, a single stream never gets threads of its own
+        created->decoder = std::make_unique<smk::decoder>(*created->input, decoder::options{ .threads = 1 });
+        created->options = options;
+        created->stride = created->decoder->width() * decoder::bytes_per_pixel(options.format);
+
+        const size_t frame_size = std::max<size_t>(created->stride * created->decoder->height(), 1);
+        created->capacity = std::max<size_t>(options.memory_budget / frame_size, 2);
+
+        if (options.loop && !created->input->seekable()) {
+            throw std::runtime_error("Looping needs a seekable input");
+        }
+        created->finished = created->decoder->num_frames() == 0;
+
+        std::scoped_lock lock(_mutex);
+        const auto id = _next_id++;
+        created->start = std::chrono::steady_clock::now();
+        auto &opened = *_streams.emplace(id, std::move(created)).first->second;
+        _schedule(id, opened);
+        return id;
+    }
+
+    service::stream_id service::open(const std::filesystem::path &path, const stream_options &options) {
+        return open(io::open(path), options);
+    }
+
+    void service::close(stream_id id) {
+        std::scoped_lock lock(_mutex);
+        auto &closed = _stream(id);
+        // a worker still owns the decoder, it removes the stream once done with it
+        if (closed.scheduled) {
+            closed.closing = true;
+        } else {
+            _streams.erase(id);
+        }
+    }
+
+    std::optional<service::frame> service::acquire(stream_id id) {
+        std::unique_lock lock(_mutex);
+        auto &s = _stream(id);
+
+        if (!s.current.pixels.empty()) {
+            s.spare.emplace_back(std::move(s.current.pixels));
+            s.current.pixels = {};
+            _schedule(id, s);
+        }
+
+        s.changed.wait(lock, [&] { return !s.ready.empty() || s.finished; });
+        if (s.ready.empty()) {
+            if (s.error) {
+                std::rethrow_exception(s.error);
+            }
+            return std::nullopt;
+        }
+
+        s.current = std::move(s.ready.front());
+        s.ready.pop_front();
+        _schedule(id, s);
+
+        return frame{ s.current.pixels, s.stride, s.current.index };
+    }
+
+    uint32_t service::width(stream_id id) {
+        std::scoped_lock lock(_mutex);
+        return _stream(id).decoder->width();
+    }
+
+    uint32_t service::height(stream_id id) {
+        std::scoped_lock lock(_mutex);
+        return _stream(id).decoder->height();
+    }
+
+    uint32_t service::num_frames(stream_id id) {
+        std::scoped_lock lock(_mutex);
+        return _stream(id).decoder->num_frames();
+    }
+
+    service::stream &service::_stream(stream_id id) {
+        const auto found = _streams.find(id);
+        if (found == _streams.end() || found->second->closing) {
+            throw std::runtime_error(std::format("Unknown stream: {}", id));
+        }
+        return *found->second;
+    }
+
+    // called with _mutex held, queues the stream's next frame if it has a buffer left in its budget
+    void service::_schedule(stream_id id, stream &s) {
+        if (s.scheduled || s.finished || s.closing) {
+            return;
+        }
+
+        if (!s.spare.empty()) {
+            s.target = std::move(s.spare.back());
+            s.spare.pop_back();
+        } else if (s.allocated < s.capacity) {
+            s.target.resize(s.stride * s.decoder->height());
+            ++s.allocated;
+        } else {
+            return;
+        }
+
+        s.scheduled = true;
+        const auto deadline = s.start + s.sequence * s.decoder->frame_duration();
+
+        // counted before it is visible, so a worker that steals it right away never takes the count below zero
+        ++_pending;
+        auto &queue = *_queues[_next_queue];
+        _next_queue = (_next_queue + 1) % _queues.size();
+        {
+            std::scoped_lock queue_lock(queue.mutex);
+            queue.tasks.push_back({ deadline, id });
+            std::ranges::push_heap(queue.tasks, later);
+        }
+
+        _work_available.notify_one();
+    }
+
+    // the earliest task of the worker's own queue, otherwise the earliest one of the first queue that has any
+    bool service::_pop(size_t worker, task &result) {
+        for (size_t n = 0; n < _queues.size(); ++n) {
+            auto &queue = *_queues[(worker + n) % _queues.size()];
+            std::scoped_lock lock(queue.mutex);
+            if (!queue.tasks.empty()) {
+                std::ranges::pop_heap(queue.tasks, later);
+                result = queue.tasks.back();
+                queue.tasks.pop_back();
+                --_pending;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void service::_work(size_t worker) {
+        while (!_stopping) {
+            task next;
+            if (_pop(worker, next)) {
+                _decode(next.id);
+                continue;
+            }
+
+            std::unique_lock lock(_mutex);
+            _work_available.wait(lock, [&] { return _stopping || _pending > 0; });
+        }
+    }
+
+    void service::_decode(stream_id id) {
+        stream *s;
+        bool closing;
+        {
+            std::scoped_lock lock(_mutex);
+            s = _streams.at(id).get();
+            closing = s->closing;
+        }
+
+        // the stream is marked scheduled, so its decoder and target buffer belong to this worker until then
+        std::exception_ptr error;
+        size_t index = 0;
+        if (!closing) {
+            try {
+                index = s->decoder->current_frame();
+                s->decoder->decode_frame({ s->target.data(), s->stride, s->options.format });
+                if (s->options.loop && s->decoder->current_frame() == s->decoder->num_frames()) {
+                    s->decoder->seek(0);
+                }
+            } catch (...) {
+                error = std::current_exception();
+            }
+        }
+
+        std::scoped_lock lock(_mutex);
+        s->scheduled = false;
+        if (s->closing) {
+            _streams.erase(id);
+            return;
+        }
+
+        if (error) {
+            s->error = error;
+            s->finished = true;
+        } else {
+            s->ready.push_back({ index, std::move(s->target) });
+            s->target = {};
+            ++s->sequence;
+            if (s->decoder->current_frame() == s->decoder->num_frames()) {
+                s->finished = true;
+            }
+        }
+
+        s->changed.notify_all();
+        _schedule(id, *s);
+    }
+}
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <cstdint>
+#include <algorithm>
+#include <chrono>
+#include <span>
+#include <vector>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <thread>
+#include <optional>
+#include <exception>
+#include <filesystem>
+
+#include "decoder.hpp"
+#include "../io/input.hpp"
+
+namespace smk {
+    // decodes many streams on one fixed pool of threads, frames are decoded in the order they are due across
+    // all streams, idle workers steal from busy ones
+    class service {
+    public:
+        struct options {
+            size_t threads = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+        };
+
+        struct stream_options {
+            decoder::pixel_format format = decoder::pixel_format::rgb24;
+            // bytes of decoded frames the stream may hold, including the one last acquired, at least two frames
+            size_t memory_budget = 16 * 1024 * 1024;
+            // starts over at the first frame instead of ending, needs a seekable input
+            bool loop = false;
+        };
+
+        struct frame {
+            // valid until the next acquire() or close() of the same stream
+            std::span<const uint8_t> pixels;
+            size_t stride;
+            size_t index;
+        };
+
+        using stream_id = size_t;
+
+        explicit service();
+        explicit service(const options &options);
+        ~service();
+
+        service(const service &) = delete;
+        service &operator=(const service &) = delete;
+
+        // the stream's clock starts here, frame n is due n frame durations later
+        stream_id open(std::unique_ptr<io::input> input, const stream_options &options);
+        stream_id open(const std::filesystem::path &path, const stream_options &options);
+        void close(stream_id id);
+
+        // waits for the next frame of the stream, nothing once it ended and rethrows if decoding it failed
+        std::optional<frame> acquire(stream_id id);
+
+        uint32_t width(stream_id id);
+        uint32_t height(stream_id id);
+        uint32_t num_frames(stream_id id);
+
+    private:
+        struct decoded {
+            size_t index;
+            std::vector<uint8_t> pixels;
+        };
+
+        struct stream {
+            std::unique_ptr<io::input> input;
+            std::unique_ptr<smk::decoder> decoder;
+            stream_options options;
+            size_t stride;
+            size_t capacity;
+            std::chrono::steady_clock::time_point start;
+
+            // frames decoded so far, counting on across loops
+            size_t sequence = 0;
+            std::deque<decoded> ready;
+            std::vector<std::vector<uint8_t>> spare;
+            decoded current;
+            std::vector<uint8_t> target;
+            size_t allocated = 0;
+
+            // a decode of this stream is queued or running, so no other worker may touch its decoder
+            bool scheduled = false;
+            bool finished = false;
+            bool closing = false;
+            std::exception_ptr error;
+            std::condition_variable changed;
+        };
+
+        struct task {
+            std::chrono::steady_clock::time_point deadline;
+            stream_id id;
+        };
+
+        struct worker_queue {
+            std::mutex mutex;
+            // heap ordered by deadline, earliest first
+            std::vector<task> tasks;
+        };
+
+        stream &_stream(stream_id id);
+        void _schedule(stream_id id, stream &stream);
+        bool _pop(size_t worker, task &result);
+        void _work(size_t worker);
+        void _decode(stream_id id);
+
+        std::mutex _mutex;
+        std::map<stream_id, std::unique_ptr<stream>> _streams;
+        stream_id _next_id = 0;
+        size_t _next_queue = 0;
+
+        std::vector<std::unique_ptr<worker_queue>> _queues;
+        std::atomic<size_t> _pending = 0;
+        std::atomic<bool> _stopping = false;
+        std::condition_variable _work_available;
+
+        // declared last so the workers are joined before anything they use is destroyed
+        std::vector<std::jthread> _workers;
+    };
+}
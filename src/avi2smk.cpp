@@ -1,21 +1,48 @@
+#include <filesystem>
 #include <fstream>
 #include <iostream>
 #include <format>
+#include <string>
+#include <string_view>
+#include <thread>
 
 #include "avi/decoder.hpp"
+#include "io/input.hpp"
 #include "smk/encoder.hpp"
 
 int main(int argc, char **argv) {
-    if (argc != 2) {
-        std::cerr << std::format("Usage: {} <input file>", argv[0]) << std::endl;
+    const auto usage = std::format("Usage: {} <input file> [--threads <count>] [--spill <temporary file>]", argv[0]);
+    if (argc < 2) {
+        std::cerr << usage << std::endl;
         return 1;
     }
 
-    std::ifstream file(argv[1], std::ios::binary);
-    avi::decoder decoder(file);
+    smk::encoder::options options;
+    options.threads = std::thread::hardware_concurrency();
+    std::filesystem::path spill_path;
+    std::fstream spill;
+    for (int n = 2; n < argc; ++n) {
+        if (std::string_view(argv[n]) == "--spill" && n + 1 < argc) {
+            spill_path = argv[++n];
+            spill.open(spill_path, std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc);
+            if (!spill) {
+                std::cerr << std::format("Could not open spill file: {}", spill_path.string()) << std::endl;
+                return 1;
+            }
+            options.spill = &spill;
+        } else if (std::string_view(argv[n]) == "--threads" && n + 1 < argc) {
+            options.threads = std::stoul(argv[++n]);
+        } else {
+            std::cerr << usage << std::endl;
+            return 1;
+        }
+    }
+
+    const auto input = io::open(argv[1]);
+    avi::decoder decoder(*input);
 
     std::ofstream output("output.smk", std::ios::binary);
-    smk::encoder encoder(decoder.width(), decoder.height(), decoder.fps());
+    smk::encoder encoder(decoder.width(), decoder.height(), decoder.fps(), options);
 
     for (size_t n = 0; n < decoder.num_frames(); ++n) {
         std::cout << std::format("Frame {}... ", n + 1) << std::flush;
@@ -24,5 +51,10 @@ int main(int argc, char **argv) {
 
     encoder.write(output);
 
+    if (spill.is_open()) {
+        spill.close();
+        std::filesystem::remove(spill_path);
+    }
+
     return 0;
 }
@@ -1,25 +1,178 @@
 #include <fstream>
 #include <iostream>
 #include <format>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <optional>
+#include <exception>
+#include <vector>
+#include <algorithm>
+#include <memory>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
 
 #include "avi/encoder.hpp"
+#include "io/input.hpp"
 #include "smk/decoder.hpp"
 
+// bounded hand-off between two pipeline stages, closing it wakes up every waiting stage
+template<typename T>
+class channel {
+public:
+    explicit channel(size_t capacity) : _capacity(capacity) {}
+
+    void push(T value) {
+        std::unique_lock lock(_mutex);
+        _not_full.wait(lock, [&] { return _closed || _items.size() < _capacity; });
+        if (_closed) {
+            return;
+        }
+        _items.push_back(std::move(value));
+        _not_empty.notify_one();
+    }
+
+    std::optional<T> pop() {
+        std::unique_lock lock(_mutex);
+        _not_empty.wait(lock, [&] { return _closed || !_items.empty(); });
+        if (_items.empty()) {
+            return std::nullopt;
+        }
+        T value = std::move(_items.front());
+        _items.pop_front();
+        _not_full.notify_one();
+        return value;
+    }
+
+    void close() {
+        std::scoped_lock lock(_mutex);
+        _closed = true;
+        _not_empty.notify_all();
+        _not_full.notify_all();
+    }
+
+private:
+    size_t _capacity;
+    bool _closed = false;
+    std::deque<T> _items;
+    std::mutex _mutex;
+    std::condition_variable _not_empty;
+    std::condition_variable _not_full;
+};
+
 int main(int argc, char **argv) {
-    if (argc != 2) {
-        std::cerr << std::format("Usage: {} <input file>", argv[0]) << std::endl;
+    const auto usage = std::format("Usage: {} <input file or - for stdin> [--threads <count>]", argv[0]);
+    if (argc < 2) {
+        std::cerr << usage << std::endl;
         return 1;
     }
 
-    std::ifstream file(argv[1], std::ios::binary);
-    smk::decoder decoder(file);
+    smk::decoder::options options;
+    options.threads = std::thread::hardware_concurrency();
+    for (int n = 2; n < argc; ++n) {
+        if (std::string_view(argv[n]) == "--threads" && n + 1 < argc) {
+            options.threads = std::stoul(argv[++n]);
+        } else {
+            std::cerr << usage << std::endl;
+            return 1;
+        }
+    }
+
+    // "-" reads from stdin, the decoder only ever reads forward so pipes work
+    std::unique_ptr<io::input> input;
+    if (std::string_view(argv[1]) == "-") {
+#ifdef _WIN32
+        _setmode(_fileno(stdin), _O_BINARY);
+#endif
+        input = std::make_unique<io::stream_input>(std::cin);
+    } else {
+        input = io::open(argv[1]);
+    }
+    smk::decoder decoder(*input, options);
 
     std::ofstream output("output.avi", std::ios::binary);
     avi::encoder encoder(output, decoder.width(), decoder.height(), decoder.framerate(), decoder.num_frames());
 
-    for (size_t n = 0; n < decoder.num_frames(); ++n) {
-        std::cout << std::format("Frame {}... ", n + 1) << std::flush;
-        encoder.encode_frame(decoder.decode_frame());
+    // decoding (which reads ahead and entropy decodes on the decoder's workers), conversion and writing run
+    // on their own threads, the free channels recycle a fixed set of frame buffers between the stages
+    constexpr size_t depth = 4;
+    channel<std::vector<uint8_t>> free_decoded(depth), decoded(depth), free_converted(depth), converted(depth);
+    for (size_t n = 0; n < depth; ++n) {
+        free_decoded.push({});
+        free_converted.push({});
+    }
+
+    std::exception_ptr error;
+    std::mutex error_mutex;
+    const auto fail = [&] {
+        {
+            std::scoped_lock lock(error_mutex);
+            if (!error) {
+                error = std::current_exception();
+            }
+        }
+        for (auto *c : { &free_decoded, &decoded, &free_converted, &converted }) {
+            c->close();
+        }
+    };
+
+    {
+        std::jthread decode_stage([&] {
+            try {
+                for (size_t n = 0; n < decoder.num_frames(); ++n) {
+                    auto buffer = free_decoded.pop();
+                    if (!buffer) {
+                        return;
+                    }
+                    buffer->resize(decoder.width() * decoder.height() * 3);
+                    decoder.decode_frame({ buffer->data(), decoder.width() * 3, smk::decoder::pixel_format::rgb24 });
+                    decoded.push(std::move(*buffer));
+                }
+            } catch (...) {
+                fail();
+            }
+        });
+
+        std::jthread convert_stage([&] {
+            try {
+                for (size_t n = 0; n < decoder.num_frames(); ++n) {
+                    auto frame = decoded.pop();
+                    auto buffer = free_converted.pop();
+                    if (!frame || !buffer) {
+                        return;
+                    }
+                    encoder.convert_frame(*frame, *buffer);
+                    free_decoded.push(std::move(*frame));
+                    converted.push(std::move(*buffer));
+                }
+            } catch (...) {
+                fail();
+            }
+        });
+
+        try {
+            for (size_t n = 0; n < decoder.num_frames(); ++n) {
+                auto frame = converted.pop();
+                if (!frame) {
+                    break;
+                }
+                std::cout << std::format("Frame {}... ", n + 1) << std::flush;
+                encoder.write_frame(*frame);
+                free_converted.push(std::move(*frame));
+            }
+        } catch (...) {
+            fail();
+        }
+    }
+
+    if (error) {
+        std::rethrow_exception(error);
     }
 
     return 0;
@@ -0,0 +1,279 @@
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstring>
+
+#include "util.hpp"
+
+template<typename T>
+void put_le(std::string &data, size_t offset, T value) {
+    for (size_t n = 0; n < sizeof(T); ++n) {
+        data[offset + n] = static_cast<char>((value >> (n * 8)) & 0xFF);
+    }
+}
+
+template<typename T>
+T get_le(const std::string &data, size_t offset) {
+    T value = 0;
+    for (size_t n = 0; n < sizeof(T); ++n) {
+        value |= static_cast<T>(static_cast<uint8_t>(data[offset + n])) << (n * 8);
+    }
+    return value;
+}
+
+// every byte value as a leaf at depth 8, the code of a value is its bits from the top
+void write_balanced_tree(smk::encoder::bitstream &bits, uint32_t low, uint32_t high) {
+    if (high - low == 1) {
+        bits.write(0, 1);
+        bits.write(low, 8);
+        return;
+    }
+    bits.write(1, 1);
+    write_balanced_tree(bits, low, (low + high) / 2);
+    write_balanced_tree(bits, (low + high) / 2, high);
+}
+
+void write_balanced_code(smk::encoder::bitstream &bits, uint8_t value) {
+    for (size_t n = 8; n-- > 0;) {
+        bits.write((value >> n) & 1, 1);
+    }
+}
+
+// DPCM chunk as the Smacker encoder lays it out, a single leaf tree when every delta of a tree is the same
+std::string compress(const std::vector<uint16_t> &samples, size_t channels, bool wide) {
+    std::vector<std::vector<uint8_t>> symbols(channels * (wide ? 2 : 1));
+    for (size_t n = channels; n < samples.size(); ++n) {
+        const size_t channel = n % channels;
+        const uint16_t delta = samples[n] - samples[n - channels];
+        if (wide) {
+            symbols[channel * 2].push_back(delta & 0xFF);
+            symbols[channel * 2 + 1].push_back(delta >> 8);
+        } else {
+            symbols[channel].push_back(delta & 0xFF);
+        }
+    }
+
+    std::vector<bool> single(symbols.size());
+    for (size_t n = 0; n < symbols.size(); ++n) {
+        single[n] = !symbols[n].empty() && std::ranges::all_of(symbols[n], [&](uint8_t symbol) { return symbol == symbols[n][0]; });
+    }
+
+    std::ostringstream out(std::ios::binary);
+    smk::encoder::bitstream bits(out);
+    bits.write(1, 1);
+    bits.write(channels == 2, 1);
+    bits.write(wide, 1);
+    for (size_t n = 0; n < symbols.size(); ++n) {
+        bits.write(1, 1);
+        if (single[n]) {
+            bits.write(0, 1);
+            bits.write(symbols[n][0], 8);
+        } else {
+            write_balanced_tree(bits, 0, 256);
+        }
+        bits.write(0, 1);
+    }
+
+    for (size_t n = channels; n-- > 0;) {
+        if (wide) {
+            bits.write(samples[n] >> 8, 8);
+        }
+        bits.write(samples[n] & 0xFF, 8);
+    }
+
+    for (size_t n = channels; n < samples.size(); ++n) {
+        const size_t channel = n % channels;
+        const uint16_t delta = samples[n] - samples[n - channels];
+        const size_t tree = wide ? channel * 2 : channel;
+        if (!single[tree]) {
+            write_balanced_code(bits, delta & 0xFF);
+        }
+        if (wide && !single[tree + 1]) {
+            write_balanced_code(bits, delta >> 8);
+        }
+    }
+    bits.flush();
+
+    std::string chunk(4, '\0');
+    put_le<uint32_t>(chunk, 0, samples.size() * (wide ? 2 : 1));
+    return chunk + out.str();
+}
+
+std::vector<uint8_t> to_pcm(const std::vector<uint16_t> &samples, bool wide) {
+    std::vector<uint8_t> pcm;
+    for (const auto sample : samples) {
+        if (wide) {
+            const int16_t value = static_cast<int16_t>(sample);
+            pcm.resize(pcm.size() + 2);
+            std::memcpy(pcm.data() + pcm.size() - 2, &value, 2);
+        } else {
+            pcm.push_back(sample & 0xFF);
+        }
+    }
+    return pcm;
+}
+
+struct track {
+    uint32_t rate_flags;
+    // per frame, empty frames carry no chunk for the track
+    std::vector<std::string> chunks;
+    std::vector<std::vector<uint8_t>> pcm;
+};
+
+// inserts the tracks' chunks behind each frame's palette and fills in the header fields
+std::string add_audio(const std::string &video, const std::vector<track> &tracks) {
+    const auto num_frames = get_le<uint32_t>(video, 12);
+    const auto trees_size = get_le<uint32_t>(video, 52);
+
+    std::string header = video.substr(0, 104);
+    for (size_t n = 0; n < tracks.size(); ++n) {
+        size_t max_size = 0;
+        for (const auto &pcm : tracks[n].pcm) {
+            max_size = std::max(max_size, pcm.size());
+        }
+        put_le<uint32_t>(header, 24 + n * 4, max_size);
+        put_le<uint32_t>(header, 72 + n * 4, tracks[n].rate_flags);
+    }
+
+    std::string sizes(num_frames * 4, '\0'), types(num_frames, '\0'), frames;
+    size_t offset = 104 + num_frames * 5 + trees_size;
+    for (size_t n = 0; n < num_frames; ++n) {
+        const auto size = get_le<uint32_t>(video, 104 + n * 4);
+        uint8_t type = video[104 + num_frames * 4 + n];
+        const std::string data = video.substr(offset, size & ~0x03);
+        offset += size & ~0x03;
+
+        const size_t palette_size = type & 0x01 ? static_cast<uint8_t>(data[0]) * 4 : 0;
+        std::string frame = data.substr(0, palette_size);
+        for (size_t m = 0; m < tracks.size(); ++m) {
+            const auto &chunk = tracks[m].chunks[n];
+            if (chunk.empty()) {
+                continue;
+            }
+            type |= 0x02 << m;
+            std::string length(4, '\0');
+            put_le<uint32_t>(length, 0, chunk.size() + 4);
+            frame += length + chunk;
+        }
+        frame += data.substr(palette_size);
+        frame.resize((frame.size() + 3) & ~size_t{3});
+
+        put_le<uint32_t>(sizes, n * 4, frame.size() | (size & 0x03));
+        types[n] = static_cast<char>(type);
+        frames += frame;
+    }
+
+    return header + sizes + types + video.substr(104 + num_frames * 5, trees_size) + frames;
+}
+
+int main() {
+    constexpr size_t num_frames = 4;
+
+    std::string video;
+    std::vector<std::vector<uint8_t>> expected_frames;
+    {
+        std::stringstream ss(std::ios::in | std::ios::out | std::ios::binary);
+        smk::encoder encoder(32, 16, 10);
+        for (size_t n = 0; n < num_frames; ++n) {
+            std::vector<uint8_t> frame(32 * 16 * 3);
+            for (size_t p = 0; p < frame.size(); ++p) {
+                frame[p] = ((p / 3) % 7 + n) * 0x20;
+            }
+            encoder.encode_frame(frame);
+        }
+        encoder.write(ss);
+        video = ss.str();
+
+        smk::decoder decoder(ss);
+        for (size_t n = 0; n < num_frames; ++n) {
+            const auto frame = decoder.decode_frame();
+            expected_frames.emplace_back(frame.begin(), frame.end());
+        }
+    }
+
+    std::vector<track> tracks(3);
+    // compressed 16-bit stereo, with deltas wrapping past both ends
+    tracks[0].rate_flags = 0x80000000 | 0x40000000 | 0x20000000 | 0x10000000 | 22050;
+    // compressed 8-bit mono with a constant delta, so every sample code is empty, and no audio on frame 2
+    tracks[1].rate_flags = 0x80000000 | 0x40000000 | 11025;
+    // raw 16-bit mono
+    tracks[2].rate_flags = 0x40000000 | 0x20000000 | 8000;
+
+    for (size_t n = 0; n < num_frames; ++n) {
+        std::vector<uint16_t> stereo;
+        for (size_t m = 0; m < 200 + n * 10; ++m) {
+            stereo.push_back(static_cast<uint16_t>(m * 9001 + n * 77));
+            stereo.push_back(static_cast<uint16_t>(0x8000 - m * m * 3));
+        }
+        tracks[0].chunks.push_back(compress(stereo, 2, true));
+        tracks[0].pcm.push_back(to_pcm(stereo, true));
+
+        std::vector<uint16_t> mono;
+        for (size_t m = 0; n != 2 && m < 150; ++m) {
+            mono.push_back((0xF0 + m * 3) & 0xFF);
+        }
+        tracks[1].chunks.push_back(mono.empty() ? std::string() : compress(mono, 1, false));
+        tracks[1].pcm.push_back(to_pcm(mono, false));
+
+        std::vector<uint16_t> raw;
+        for (size_t m = 0; m < 64; ++m) {
+            raw.push_back(static_cast<uint16_t>(m * 1000 - 30000));
+        }
+        std::string raw_chunk;
+        for (const auto sample : raw) {
+            raw_chunk.push_back(static_cast<char>(sample & 0xFF));
+            raw_chunk.push_back(static_cast<char>(sample >> 8));
+        }
+        tracks[2].chunks.push_back(raw_chunk);
+        tracks[2].pcm.push_back(to_pcm(raw, true));
+    }
+
+    const auto data = add_audio(video, tracks);
+
+    for (const size_t threads : { 1, 3 }) {
+        std::istringstream ss(data, std::ios::binary);
+        smk::decoder decoder(ss, { .threads = threads });
+
+        const auto &info = decoder.audio_tracks();
+        expect_eq(info[0].rate, 22050);
+        expect_eq(info[0].channels, 2);
+        expect_eq(info[0].bits, 16);
+        expect_eq(info[0].compressed, true);
+        expect_eq(info[0].max_size, tracks[0].pcm.back().size());
+        expect_eq(info[1].channels, 1);
+        expect_eq(info[1].bits, 8);
+        expect_eq(info[2].compressed, false);
+        expect_eq(info[3].rate, 0);
+
+        std::vector<uint8_t> pcm(4096);
+        for (size_t n = 0; n < num_frames; ++n) {
+            expect_eq(std::ranges::equal(decoder.decode_frame(), expected_frames[n]), true);
+
+            for (size_t m = 0; m < tracks.size(); ++m) {
+                const auto &expected = tracks[m].pcm[n];
+                expect_eq(decoder.audio_size(m), expected.size());
+                const auto size = decoder.decode_audio(m, pcm);
+                expect_eq(size, expected.size());
+                expect_eq(std::ranges::equal(std::span(pcm).first(size), expected), true);
+            }
+            expect_eq(decoder.audio_size(5), 0);
+        }
+        expect_throw([&] { decoder.audio_size(7); });
+    }
+
+    {
+        std::istringstream ss(data, std::ios::binary);
+        smk::decoder decoder(ss);
+        decoder.seek(3);
+        decoder.decode_frame();
+
+        std::vector<uint8_t> pcm(tracks[0].pcm[3].size());
+        expect_eq(decoder.decode_audio(0, pcm), pcm.size());
+        expect_eq(pcm == tracks[0].pcm[3], true);
+
+        std::vector<uint8_t> small(pcm.size() - 1);
+        expect_throw([&] { decoder.decode_audio(0, small); });
+    }
+
+    return 0;
+}
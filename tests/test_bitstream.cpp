@@ -20,6 +20,7 @@ int main() {
     {
         auto decoder = smk::decoder(ss, true);
 
+        decoder._read_buffer(ss.str().size());
         decoder._init_bitstream();
 
         expect_eq(decoder._bitstream_read_bit(), 1);
@@ -48,6 +49,7 @@ int main() {
     {
         auto decoder = smk::decoder(ss, true);
 
+        decoder._read_buffer(ss.str().size());
         decoder._init_bitstream();
 
         expect_eq(decoder._bitstream_read_byte(), 0b10101010);
@@ -0,0 +1,320 @@
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <cstring>
+
+#include "util.hpp"
+
+constexpr std::array<uint8_t, 64> palmap = {
+    0x00, 0x04, 0x08, 0x0C, 0x10, 0x14, 0x18, 0x1C,
+    0x20, 0x24, 0x28, 0x2C, 0x30, 0x34, 0x38, 0x3C,
+    0x41, 0x45, 0x49, 0x4D, 0x51, 0x55, 0x59, 0x5D,
+    0x61, 0x65, 0x69, 0x6D, 0x71, 0x75, 0x79, 0x7D,
+    0x82, 0x86, 0x8A, 0x8E, 0x92, 0x96, 0x9A, 0x9E,
+    0xA2, 0xA6, 0xAA, 0xAE, 0xB2, 0xB6, 0xBA, 0xBE,
+    0xC3, 0xC7, 0xCB, 0xCF, 0xD3, 0xD7, 0xDB, 0xDF,
+    0xE3, 0xE7, 0xEB, 0xEF, 0xF3, 0xF7, 0xFB, 0xFF
+};
+
+// colors come from the palette map so they survive the round trip unchanged
+std::vector<std::vector<uint8_t>> make_frames(uint32_t width, uint32_t height, size_t count) {
+    std::vector<std::vector<uint8_t>> frames;
+    for (size_t n = 0; n < count; ++n) {
+        std::vector<uint8_t> frame(width * height * 3);
+        for (size_t y = 0; y < height; ++y) {
+            for (size_t x = 0; x < width; ++x) {
+                const size_t p = (y * width + x) * 3;
+                const size_t color = y < height / 2 ? (x / 8) % 2 : (x * 3 + y + n * 5) % 40;
+                frame[p] = palmap[color];
+                frame[p + 1] = palmap[63 - color];
+                frame[p + 2] = palmap[(color % 5) * 13];
+            }
+        }
+        frames.emplace_back(std::move(frame));
+    }
+    return frames;
+}
+
+void test_seek(const std::vector<std::vector<uint8_t>> &frames, std::stringstream &ss) {
+    ss.clear();
+    ss.seekg(0);
+    smk::decoder decoder(ss);
+
+    for (const size_t frame : { 7, 2, 10, 0, 5 }) {
+        decoder.seek(frame);
+        expect_eq(decoder.current_frame(), frame);
+        expect_eq(std::ranges::equal(decoder.decode_frame(), frames[frame]), true);
+        expect_eq(std::ranges::equal(decoder.decode_frame(), frames[frame + 1]), true);
+    }
+}
+
+void test_seek_keyframes() {
+    // every pixel changes every frame, so each frame can be flagged as a keyframe
+    std::vector<std::vector<uint8_t>> frames;
+    for (size_t n = 0; n < 8; ++n) {
+        std::vector<uint8_t> frame(32 * 16 * 3);
+        for (size_t p = 0; p < 32 * 16; ++p) {
+            const size_t color = (p * 7 + n * 3) % 50 + 1;
+            frame[p * 3] = palmap[color];
+            frame[p * 3 + 1] = palmap[color];
+            frame[p * 3 + 2] = palmap[63 - color];
+        }
+        frames.emplace_back(std::move(frame));
+    }
+
+    std::stringstream ss(std::ios::in | std::ios::out | std::ios::binary);
+    smk::encoder encoder(32, 16, 15);
+    for (auto &frame : frames) {
+        encoder.encode_frame(frame);
+    }
+    encoder.write(ss);
+
+    // frame size table follows the 104 byte header
+    auto data = ss.str();
+    for (size_t n = 1; n < frames.size(); n += 3) {
+        data[104 + n * 4] |= 0x01;
+    }
+    ss.str(data);
+
+    smk::decoder decoder(ss, { .threads = 2 });
+    for (const size_t frame : { 6, 1, 3, 7, 4 }) {
+        decoder.seek(frame);
+        expect_eq(std::ranges::equal(decoder.decode_frame(), frames[frame]), true);
+    }
+}
+
+// hands out the data in small pieces and refuses to seek, like a pipe
+class pipe_buffer : public std::streambuf {
+public:
+    explicit pipe_buffer(std::string data) : _data(std::move(data)) {}
+
+protected:
+    int_type underflow() override {
+        if (_pos >= _data.size()) {
+            return traits_type::eof();
+        }
+        const size_t count = std::min<size_t>(7, _data.size() - _pos);
+        setg(_data.data() + _pos, _data.data() + _pos, _data.data() + _pos + count);
+        _pos += count;
+        return traits_type::to_int_type(*gptr());
+    }
+
+private:
+    std::string _data;
+    size_t _pos = 0;
+};
+
+void test_pipe(const std::vector<std::vector<uint8_t>> &frames, const std::string &data) {
+    for (const size_t threads : { 1, 3 }) {
+        pipe_buffer buffer(data);
+        std::istream pipe(&buffer);
+        io::stream_input input(pipe);
+        expect_eq(input.seekable(), false);
+
+        smk::decoder decoder(input, { .threads = threads });
+        for (const auto &frame : frames) {
+            expect_eq(std::ranges::equal(decoder.decode_frame(), frame), true);
+        }
+
+        expect_throw([&] { decoder.seek(0); });
+    }
+}
+
+// the top half of every frame repeats, so after the first frame only the bottom half is decoded as changed
+void test_changed_regions(const std::vector<std::vector<uint8_t>> &frames, std::stringstream &ss) {
+    ss.seekg(0);
+    smk::decoder decoder(ss);
+    for (size_t n = 0; n < frames.size(); ++n) {
+        decoder.decode_frame();
+
+        const auto blocks = decoder.changed_blocks();
+        expect_eq(blocks.size(), 16 * 12);
+        for (size_t m = 0; m < blocks.size(); ++m) {
+            expect_eq(blocks[m] != 0, n == 0 || m >= 16 * 6);
+        }
+
+        const auto regions = decoder.changed_regions();
+        expect_eq(regions.size(), 1);
+        expect_eq(regions[0].x, 0);
+        expect_eq(regions[0].y, n == 0 ? 0 : 24);
+        expect_eq(regions[0].width, 64);
+        expect_eq(regions[0].height, n == 0 ? 48 : 24);
+    }
+
+    // after seeking nothing is known about what the caller holds, so everything counts as changed
+    decoder.seek(5);
+    decoder.decode_frame();
+    expect_eq(std::ranges::all_of(decoder.changed_blocks(), [](uint8_t changed) { return changed != 0; }), true);
+}
+
+// every preview pixel is one of its block's pixels, blocks of a single color keep exactly that color
+void test_preview(const std::vector<std::vector<uint8_t>> &frames, std::stringstream &ss) {
+    ss.seekg(0);
+    smk::decoder decoder(ss);
+    expect_eq(decoder.preview_width(), 16);
+    expect_eq(decoder.preview_height(), 12);
+
+    std::vector<std::vector<uint8_t>> previews;
+    for (const auto &frame : frames) {
+        std::vector<uint8_t> preview(16 * 12 * 3);
+        decoder.decode_frame_preview({ preview.data(), 16 * 3, smk::decoder::pixel_format::rgb24 });
+
+        for (size_t by = 0; by < 12; ++by) {
+            for (size_t bx = 0; bx < 16; ++bx) {
+                const auto pixel = std::span(preview).subspan((by * 16 + bx) * 3, 3);
+                bool found = false, uniform = true;
+                for (size_t y = by * 4; y < by * 4 + 4; ++y) {
+                    for (size_t x = bx * 4; x < bx * 4 + 4; ++x) {
+                        const auto color = std::span(frame).subspan((y * 64 + x) * 3, 3);
+                        found = found || std::ranges::equal(color, pixel);
+                        uniform = uniform && std::ranges::equal(color, std::span(frame).subspan((by * 4 * 64 + bx * 4) * 3, 3));
+                    }
+                }
+                expect_eq(found, true);
+                expect_eq(!uniform || std::ranges::equal(pixel, std::span(frame).subspan((by * 4 * 64 + bx * 4) * 3, 3)), true);
+            }
+        }
+
+        previews.emplace_back(std::move(preview));
+    }
+
+    // switching modes mid-stream replays from the keyframe in the new mode
+    ss.seekg(0);
+    smk::decoder mixed(ss);
+    std::vector<uint8_t> preview(16 * 12 * 3);
+    for (size_t n = 0; n < frames.size(); ++n) {
+        if (n % 4 < 2) {
+            mixed.decode_frame_preview({ preview.data(), 16 * 3, smk::decoder::pixel_format::rgb24 });
+            expect_eq(preview == previews[n], true);
+        } else {
+            expect_eq(std::ranges::equal(mixed.decode_frame(), frames[n]), true);
+        }
+    }
+}
+
+int main() {
+    auto frames = make_frames(64, 48, 12);
+
+    std::stringstream ss(std::ios::in | std::ios::out | std::ios::binary);
+    {
+        smk::encoder encoder(64, 48, 15);
+        for (auto &frame : frames) {
+            encoder.encode_frame(frame);
+        }
+        encoder.write(ss);
+    }
+
+    smk::decoder decoder(ss);
+    expect_eq(decoder.width(), 64);
+    expect_eq(decoder.height(), 48);
+    expect_eq(decoder.num_frames(), frames.size());
+
+    for (const auto &frame : frames) {
+        const auto decoded = decoder.decode_frame();
+        expect_eq(std::ranges::equal(decoded, frame), true);
+    }
+
+    ss.seekg(0);
+    smk::decoder portable(ss, { .simd = false });
+    for (const auto &frame : frames) {
+        const auto decoded = portable.decode_frame();
+        expect_eq(std::ranges::equal(decoded, frame), true);
+    }
+
+    ss.seekg(0);
+    smk::decoder threaded(ss, { .threads = 3 });
+    for (const auto &frame : frames) {
+        const auto decoded = threaded.decode_frame();
+        expect_eq(std::ranges::equal(decoded, frame), true);
+    }
+
+    {
+        // same stream through a memory mapped file, threaded so frames are handed to workers as views
+        const auto path = std::filesystem::temp_directory_path() / "avi2smk_test_decoder.smk";
+        {
+            std::ofstream file(path, std::ios::binary);
+            file << ss.str();
+        }
+
+        {
+            io::mapped_input input(path);
+            smk::decoder mapped(input, { .threads = 2 });
+            for (const auto &frame : frames) {
+                expect_eq(std::ranges::equal(mapped.decode_frame(), frame), true);
+            }
+        }
+
+        std::filesystem::remove(path);
+    }
+
+    test_pipe(frames, ss.str());
+    test_seek(frames, ss);
+    test_seek_keyframes();
+    test_changed_regions(frames, ss);
+    test_preview(frames, ss);
+
+    ss.seekg(0);
+    smk::decoder indexed(ss);
+    for (size_t n = 0; n < frames.size(); ++n) {
+        const auto decoded = indexed.decode_frame_indexed();
+        expect_eq(decoded.indices.size(), 64 * 48);
+        expect_eq(decoded.palette_changed, n == 0);
+        for (size_t m = 0; m < decoded.indices.size(); ++m) {
+            const auto &color = decoded.colors[decoded.indices[m]];
+            expect_eq(std::ranges::equal(color, std::span(frames[n]).subspan(m * 3, 3)), true);
+        }
+    }
+
+    for (const auto format : { smk::decoder::pixel_format::rgb24, smk::decoder::pixel_format::bgr24, smk::decoder::pixel_format::rgba8888, smk::decoder::pixel_format::bgra8888, smk::decoder::pixel_format::rgb565 }) {
+        const size_t bpp = smk::decoder::bytes_per_pixel(format);
+        const size_t stride = 64 * bpp + 12;
+        std::vector<uint8_t> surface(stride * 48, 0xCD);
+
+        // the vectorized and the portable kernels have to produce the same pixels
+        std::vector<uint8_t> portable_surface(surface);
+
+        ss.seekg(0);
+        smk::decoder target(ss);
+        std::stringstream portable_ss(ss.str(), std::ios::in | std::ios::binary);
+        smk::decoder portable_target(portable_ss, { .simd = false });
+        for (const auto &frame : frames) {
+            target.decode_frame({ surface.data(), stride, format });
+            portable_target.decode_frame({ portable_surface.data(), stride, format });
+            expect_eq(surface == portable_surface, true);
+
+            for (size_t y = 0; y < 48; ++y) {
+                for (size_t x = 0; x < 64; ++x) {
+                    const uint8_t *pixel = surface.data() + y * stride + x * bpp;
+                    const uint8_t *expected = frame.data() + (y * 64 + x) * 3;
+                    const uint8_t r = expected[0], g = expected[1], b = expected[2];
+                    switch (format) {
+                        case smk::decoder::pixel_format::rgb24:
+                            expect_eq(std::ranges::equal(std::span(pixel, 3), std::array{ r, g, b }), true);
+                            break;
+                        case smk::decoder::pixel_format::bgr24:
+                            expect_eq(std::ranges::equal(std::span(pixel, 3), std::array{ b, g, r }), true);
+                            break;
+                        case smk::decoder::pixel_format::rgba8888:
+                            expect_eq(std::ranges::equal(std::span(pixel, 4), std::array<uint8_t, 4>{ r, g, b, 0xFF }), true);
+                            break;
+                        case smk::decoder::pixel_format::bgra8888:
+                            expect_eq(std::ranges::equal(std::span(pixel, 4), std::array<uint8_t, 4>{ b, g, r, 0xFF }), true);
+                            break;
+                        case smk::decoder::pixel_format::rgb565: {
+                            uint16_t color;
+                            std::memcpy(&color, pixel, sizeof(color));
+                            expect_eq(color, ((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3));
+                            break;
+                        }
+                    }
+                }
+
+                // padding between rows is left alone
+                expect_eq(surface[y * stride + 64 * bpp], 0xCD);
+            }
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,61 @@
+#include <sstream>
+#include <vector>
+
+#include "util.hpp"
+
+std::vector<std::vector<uint8_t>> make_frames(uint32_t width, uint32_t height, size_t count) {
+    std::vector<std::vector<uint8_t>> frames;
+    for (size_t n = 0; n < count; ++n) {
+        std::vector<uint8_t> frame(width * height * 3);
+        for (size_t y = 0; y < height; ++y) {
+            for (size_t x = 0; x < width; ++x) {
+                const size_t p = (y * width + x) * 3;
+                const uint8_t color = y < height / 2 ? (x / 8) % 2 : (x * 3 + y + n * 5) % 40;
+                frame[p] = color * 4;
+                frame[p + 1] = 0xFF - color * 4;
+                frame[p + 2] = (color % 5) * 0x41;
+            }
+        }
+        frames.emplace_back(std::move(frame));
+    }
+    return frames;
+}
+
+int main() {
+    auto frames = make_frames(64, 48, 12);
+
+    std::ostringstream buffered(std::ios::binary);
+    {
+        smk::encoder encoder(64, 48, 15);
+        for (auto &frame : frames) {
+            encoder.encode_frame(frame);
+        }
+        encoder.write(buffered);
+    }
+
+    std::stringstream spilled(std::ios::in | std::ios::out | std::ios::binary);
+    {
+        std::stringstream spill(std::ios::in | std::ios::out | std::ios::binary);
+        smk::encoder encoder(64, 48, 15, { .spill = &spill, .threads = 5 });
+        for (auto &frame : frames) {
+            encoder.encode_frame(frame);
+        }
+        expect_eq(encoder._frames.size(), 0);
+        encoder.write(spilled);
+    }
+
+    std::ostringstream threaded(std::ios::binary);
+    {
+        smk::encoder encoder(64, 48, 15, { .threads = 4 });
+        for (auto &frame : frames) {
+            encoder.encode_frame(frame);
+        }
+        encoder.write(threaded);
+    }
+
+    expect_eq(spilled.str().size(), buffered.str().size());
+    expect_eq(spilled.str() == buffered.str(), true);
+    expect_eq(threaded.str() == buffered.str(), true);
+
+    return 0;
+}
@@ -0,0 +1,244 @@
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstring>
+
+#include "util.hpp"
+
+template<typename T>
+void put_le(std::string &data, size_t offset, T value) {
+    for (size_t n = 0; n < sizeof(T); ++n) {
+        data[offset + n] = static_cast<char>((value >> (n * 8)) & 0xFF);
+    }
+}
+
+// a huff8 tree of one leaf, or of two leaves with the codes 0 and 1
+void write_tree8(smk::encoder::bitstream &bits, const std::vector<uint8_t> &values) {
+    bits.write(1, 1);
+    if (values.size() == 2) {
+        bits.write(1, 1);
+        bits.write(0, 1);
+        bits.write(values[0], 8);
+    }
+    bits.write(0, 1);
+    bits.write(values.back(), 8);
+    bits.write(0, 1);
+}
+
+// a huff16 tree of one leaf, or of two leaves with the codes 0 and 1, built from two-leaf byte trees
+void write_tree16(smk::encoder::bitstream &bits, const std::vector<uint16_t> &leaves) {
+    std::vector<uint8_t> low, high;
+    for (const auto leaf : leaves) {
+        low.push_back(leaf & 0xFF);
+        high.push_back(leaf >> 8);
+    }
+
+    bits.write(1, 1);
+    write_tree8(bits, low);
+    write_tree8(bits, high);
+    for (const uint16_t cache : { 0xA0A0, 0xB0B0, 0xC0C0 }) {
+        bits.write(cache, 16);
+    }
+
+    if (leaves.size() == 2) {
+        bits.write(1, 1);
+    }
+    for (size_t n = 0; n < leaves.size(); ++n) {
+        bits.write(0, 1);
+        if (leaves.size() == 2) {
+            bits.write(n, 1);
+            bits.write(n, 1);
+        }
+    }
+    bits.write(0, 1);
+}
+
+constexpr uint16_t A = 0x3311;
+constexpr uint16_t B = 0x4422;
+
+// 8x4 SMK4 file of two frames whose every block is a full chain of one, the full tree has two leaves so the
+// bitstream spells out the layout and the symbols of each block
+std::string make_version4(const std::vector<std::pair<uint8_t, std::vector<uint16_t>>> &blocks) {
+    std::ostringstream trees(std::ios::binary);
+    {
+        smk::encoder::bitstream bits(trees);
+        write_tree16(bits, { 0 });
+        write_tree16(bits, { 0 });
+        write_tree16(bits, { A, B });
+        write_tree16(bits, { 0x0001 });
+        bits.flush();
+    }
+
+    std::vector<std::string> data;
+    for (size_t n = 0; n < blocks.size(); n += 2) {
+        std::ostringstream frame(std::ios::binary);
+        smk::encoder::bitstream bits(frame);
+        for (size_t m = n; m < n + 2; ++m) {
+            const auto &[mode, symbols] = blocks[m];
+            if (mode == 1) {
+                bits.write(1, 1);
+            } else {
+                bits.write(0, 1);
+                bits.write(mode == 2, 1);
+            }
+            for (const auto symbol : symbols) {
+                bits.write(symbol == B, 1);
+            }
+        }
+        bits.flush();
+        data.emplace_back(frame.str());
+        data.back().resize((data.back().size() + 3) & ~size_t{3});
+    }
+
+    std::string header(104, '\0');
+    header.replace(0, 4, "SMK4");
+    put_le<uint32_t>(header, 4, 8);
+    put_le<uint32_t>(header, 8, 4);
+    put_le<uint32_t>(header, 12, data.size());
+    put_le<uint32_t>(header, 16, 100);
+    put_le<uint32_t>(header, 52, trees.str().size());
+    for (size_t n = 0; n < 4; ++n) {
+        put_le<uint32_t>(header, 56 + n * 4, 64);
+    }
+
+    std::string sizes(data.size() * 4, '\0'), types(data.size(), '\0'), body;
+    for (size_t n = 0; n < data.size(); ++n) {
+        put_le<uint32_t>(sizes, n * 4, data[n].size() | (n == 0 ? 0x01 : 0x00));
+        body += data[n];
+    }
+
+    return header + sizes + types + trees.str() + body;
+}
+
+// what each layout puts into the block's rows
+std::array<std::array<uint8_t, 4>, 4> expected_block(uint8_t mode, const std::vector<uint16_t> &symbols) {
+    const auto row = [](uint16_t left, uint16_t right) {
+        return std::array<uint8_t, 4>{ static_cast<uint8_t>(left & 0xFF), static_cast<uint8_t>(left >> 8), static_cast<uint8_t>(right & 0xFF), static_cast<uint8_t>(right >> 8) };
+    };
+
+    std::array<std::array<uint8_t, 4>, 4> rows;
+    for (size_t n = 0; n < 4; ++n) {
+        if (mode == 0) {
+            rows[n] = row(symbols[n * 2 + 1], symbols[n * 2]);
+        } else if (mode == 1) {
+            const uint16_t symbol = symbols[n / 2];
+            const uint8_t low = symbol & 0xFF, high = symbol >> 8;
+            rows[n] = { low, low, high, high };
+        } else {
+            rows[n] = row(symbols[(n / 2) * 2 + 1], symbols[(n / 2) * 2]);
+        }
+    }
+    return rows;
+}
+
+void test_version4() {
+    // two blocks per frame
+    const std::vector<std::pair<uint8_t, std::vector<uint16_t>>> blocks = {
+        { 1, { A, B } },
+        { 2, { A, B, B, A } },
+        { 0, { A, B, B, A, A, A, B, B } },
+        { 1, { B, B } },
+    };
+    const auto data = make_version4(blocks);
+
+    for (const size_t threads : { 1, 2 }) {
+        std::istringstream ss(data, std::ios::binary);
+        smk::decoder decoder(ss, { .threads = threads });
+        expect_eq(decoder.num_frames(), 2);
+
+        for (size_t n = 0; n < 2; ++n) {
+            const auto frame = decoder.decode_frame_indexed();
+            for (size_t block = 0; block < 2; ++block) {
+                const auto &[mode, symbols] = blocks[n * 2 + block];
+                const auto rows = expected_block(mode, symbols);
+                for (size_t y = 0; y < 4; ++y) {
+                    expect_eq(std::ranges::equal(frame.indices.subspan(y * 8 + block * 4, 4), rows[y]), true);
+                }
+            }
+        }
+    }
+}
+
+// patches the flags of an SMK2 file, the ring frame flag needs one more frame in the tables than the header says
+std::string with_flags(std::string data, uint32_t flags) {
+    put_le<uint32_t>(data, 20, flags);
+    if (flags & 0x01) {
+        const uint32_t frames = static_cast<uint8_t>(data[12]) | (static_cast<uint8_t>(data[13]) << 8);
+        put_le<uint32_t>(data, 12, frames - 1);
+    }
+    return data;
+}
+
+void test_flags() {
+    std::vector<std::vector<uint8_t>> frames;
+    std::stringstream ss(std::ios::in | std::ios::out | std::ios::binary);
+    {
+        smk::encoder encoder(16, 8, 10);
+        for (size_t n = 0; n < 3; ++n) {
+            std::vector<uint8_t> frame(16 * 8 * 3);
+            for (size_t p = 0; p < frame.size(); ++p) {
+                frame[p] = ((p / 3) % 5 + n * 2) * 0x1C;
+            }
+            encoder.encode_frame(frame);
+        }
+        encoder.write(ss);
+    }
+    {
+        smk::decoder decoder(ss);
+        for (size_t n = 0; n < 3; ++n) {
+            const auto frame = decoder.decode_frame();
+            frames.emplace_back(frame.begin(), frame.end());
+        }
+    }
+    const auto data = ss.str();
+
+    {
+        std::istringstream ring(with_flags(data, 0x01), std::ios::binary);
+        smk::decoder decoder(ring);
+        expect_eq(decoder.num_frames(), 3);
+        for (const auto &frame : frames) {
+            expect_eq(std::ranges::equal(decoder.decode_frame(), frame), true);
+        }
+    }
+
+    for (const uint32_t flags : { 0x02, 0x04 }) {
+        std::istringstream doubled(with_flags(data, flags), std::ios::binary);
+        smk::decoder decoder(doubled);
+        expect_eq(decoder.height(), 16);
+        expect_eq(decoder.y_interlaced(), flags == 0x02);
+        expect_eq(decoder.y_doubled(), flags == 0x04);
+
+        for (const auto &frame : frames) {
+            const auto decoded = decoder.decode_frame();
+            expect_eq(decoded.size(), 16 * 16 * 3);
+            for (size_t y = 0; y < 16; ++y) {
+                const auto row = decoded.subspan(y * 16 * 3, 16 * 3);
+                if (y % 2 == 1 && flags == 0x02) {
+                    expect_eq(std::ranges::all_of(row, [](uint8_t value) { return value == 0; }), true);
+                } else {
+                    expect_eq(std::ranges::equal(row, std::span(frame).subspan((y / 2) * 16 * 3, 16 * 3)), true);
+                }
+            }
+        }
+
+        // interlaced black rows keep an opaque alpha
+        std::vector<uint8_t> surface(16 * 4 * 16);
+        std::istringstream again(with_flags(data, flags), std::ios::binary);
+        smk::decoder rgba(again);
+        rgba.decode_frame({ surface.data(), 16 * 4, smk::decoder::pixel_format::rgba8888 });
+        expect_eq(surface[16 * 4 + 3], 0xFF);
+        expect_eq(rgba.changed_regions()[0].height, 16);
+    }
+
+    expect_throw([&] {
+        std::istringstream unknown(with_flags(data, 0x08), std::ios::binary);
+        smk::decoder decoder(unknown);
+    });
+}
+
+int main() {
+    test_version4();
+    test_flags();
+
+    return 0;
+}
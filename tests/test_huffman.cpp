@@ -33,6 +33,7 @@ void test_decode8() {
     bitstream.flush();
 
     smk::decoder decoder(ss, true);
+    decoder._read_buffer(ss.str().size());
     decoder._init_bitstream();
     const auto huff8 = decoder._build_hoff8();
 
@@ -63,6 +64,83 @@ void test_decode16() {
     bitstream.flush();
 
     smk::decoder decoder(ss, true);
+    decoder._read_buffer(ss.str().size());
+    decoder._init_bitstream();
+    auto huff16 = decoder._build_hoff16();
+
+    for (const auto &c : text) {
+        expect_eq(decoder._lookup_hoff16(huff16), c);
+    }
+}
+
+void test_limited16() {
+    std::vector<uint16_t> text;
+    size_t a = 1, b = 1;
+    for (uint16_t symbol = 0x100; symbol < 0x100 + 24; ++symbol) {
+        text.insert(text.end(), a, symbol);
+        b = std::exchange(a, a + b);
+    }
+
+    std::stringstream ss;
+    auto bitstream = smk::encoder::bitstream(ss);
+
+    auto huffman_tree = smk::encoder::huffman_tree<uint16_t>(bitstream, 12);
+
+    for (const auto &c : text) {
+        huffman_tree.write(c);
+    }
+
+    huffman_tree.pack();
+
+    for (const auto &code : huffman_tree._huff_table) {
+        if (code.length != decltype(huffman_tree)::code_type::none && code.length > 12) {
+            throw std::runtime_error(std::format("Code length {} exceeds limit", code.length));
+        }
+    }
+
+    for (const auto &c : text) {
+        huffman_tree.write(c);
+    }
+
+    bitstream.flush();
+
+    smk::decoder decoder(ss, true);
+    decoder._read_buffer(ss.str().size());
+    decoder._init_bitstream();
+    auto huff16 = decoder._build_hoff16();
+
+    for (const auto &c : text) {
+        expect_eq(decoder._lookup_hoff16(huff16), c);
+    }
+}
+
+void test_deep16() {
+    std::vector<uint16_t> text;
+    size_t a = 1, b = 1;
+    for (uint16_t symbol = 0x100; symbol < 0x100 + 26; ++symbol) {
+        text.insert(text.end(), a, symbol);
+        b = std::exchange(a, a + b);
+    }
+
+    std::stringstream ss;
+    auto bitstream = smk::encoder::bitstream(ss);
+
+    auto huffman_tree = smk::encoder::huffman_tree<uint16_t>(bitstream);
+
+    for (const auto &c : text) {
+        huffman_tree.write(c);
+    }
+
+    huffman_tree.pack();
+
+    for (const auto &c : text) {
+        huffman_tree.write(c);
+    }
+
+    bitstream.flush();
+
+    smk::decoder decoder(ss, true);
+    decoder._read_buffer(ss.str().size());
     decoder._init_bitstream();
     auto huff16 = decoder._build_hoff16();
 
@@ -74,6 +152,8 @@ void test_decode16() {
 int main() {
     test_decode8();
     test_decode16();
+    test_limited16();
+    test_deep16();
 
     return 0;
 }
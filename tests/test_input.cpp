@@ -0,0 +1,62 @@
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include "util.hpp"
+
+void check_input(io::input &input, const std::string &data) {
+    expect_eq(input.tell(), 0);
+
+    auto bytes = input.read(4);
+    expect_eq(std::string(bytes.begin(), bytes.end()), data.substr(0, 4));
+
+    input.skip(6);
+    expect_eq(input.tell(), 10);
+
+    bytes = input.read(5);
+    expect_eq(std::string(bytes.begin(), bytes.end()), data.substr(10, 5));
+
+    input.seek(2);
+    bytes = input.read(3);
+    expect_eq(std::string(bytes.begin(), bytes.end()), data.substr(2, 3));
+
+    expect_throw([&] { input.read(data.size()); });
+}
+
+int main() {
+    std::string data;
+    for (size_t n = 0; n < 1000; ++n) {
+        data.push_back(static_cast<char>(n * 7));
+    }
+
+    const auto path = std::filesystem::temp_directory_path() / "avi2smk_test_input.bin";
+    {
+        std::ofstream file(path, std::ios::binary);
+        file.write(data.data(), data.size());
+    }
+
+    {
+        io::mapped_input mapped(path);
+        expect_eq(mapped.persistent(), true);
+        check_input(mapped, data);
+    }
+
+    {
+        auto opened = io::open(path);
+        check_input(*opened, data);
+    }
+
+    {
+        std::istringstream ss(data);
+        io::stream_input stream(ss);
+        expect_eq(stream.persistent(), false);
+        check_input(stream, data);
+    }
+
+    expect_throw([&] { io::open(path.string() + ".missing"); });
+
+    std::filesystem::remove(path);
+
+    return 0;
+}
@@ -27,6 +27,7 @@ int main() {
     encoder._write_palette(ss, palette);
 
     smk::decoder decoder(ss, true);
+    decoder._read_buffer(ss.str().size());
     decoder._read_palette();
 
     expect_eq(decoder._palette, palette);
@@ -0,0 +1,140 @@
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include "util.hpp"
+#include "../lib/smk/player.hpp"
+
+std::vector<std::vector<uint8_t>> make_frames(uint32_t width, uint32_t height, size_t count) {
+    std::vector<std::vector<uint8_t>> frames;
+    for (size_t n = 0; n < count; ++n) {
+        std::vector<uint8_t> frame(width * height * 3);
+        for (size_t p = 0; p < frame.size(); p += 3) {
+            frame[p] = n * 0x10;
+            frame[p + 1] = 0xFF - n * 0x10;
+            frame[p + 2] = 0x80;
+        }
+        frames.emplace_back(std::move(frame));
+    }
+    return frames;
+}
+
+// keeps what it was shown and optionally takes longer than a frame to show it
+class recording_sink : public smk::sink {
+public:
+    std::vector<size_t> frames;
+    std::vector<std::vector<uint8_t>> pixels;
+    std::chrono::milliseconds delay{0};
+
+    void present(size_t frame, std::span<const uint8_t> data, size_t) override {
+        frames.push_back(frame);
+        pixels.emplace_back(data.begin(), data.end());
+        std::this_thread::sleep_for(delay);
+    }
+};
+
+int main() {
+    const auto frames = make_frames(32, 16, 10);
+
+    std::stringstream ss(std::ios::in | std::ios::out | std::ios::binary);
+    {
+        smk::encoder encoder(32, 16, 50);
+        for (const auto &frame : frames) {
+            encoder.encode_frame(frame);
+        }
+        encoder.write(ss);
+    }
+
+    {
+        ss.seekg(0);
+        smk::decoder decoder(ss);
+        expect_eq(decoder.frame_duration().count(), 20000);
+
+        smk::null_sink sink;
+        smk::player player(decoder, sink);
+        const auto start = std::chrono::steady_clock::now();
+        const auto stats = player.play();
+        const auto elapsed = std::chrono::steady_clock::now() - start;
+
+        // the last frame is due nine frame durations after the first
+        expect_eq(elapsed >= std::chrono::milliseconds(180), true);
+        expect_eq(stats.presented + stats.dropped, frames.size());
+        expect_eq(stats.decode_p50 <= stats.decode_p95 && stats.decode_p95 <= stats.decode_p99 && stats.decode_p99 <= stats.decode_max, true);
+        expect_eq(stats.average_occupancy > 0 && stats.average_occupancy <= 4, true);
+        expect_eq(stats.min_occupancy <= 4, true);
+    }
+
+    // what a plain decoder produces, the palette is stored with 6 bits per channel
+    std::vector<std::vector<uint8_t>> decoded;
+    {
+        ss.seekg(0);
+        smk::decoder decoder(ss);
+        for (size_t n = 0; n < frames.size(); ++n) {
+            const auto frame = decoder.decode_frame();
+            decoded.emplace_back(frame.begin(), frame.end());
+        }
+    }
+
+    {
+        ss.seekg(0);
+        smk::decoder decoder(ss);
+        recording_sink sink;
+        smk::player player(decoder, sink, { .ring_size = 2, .speed = 4 });
+        const auto stats = player.play();
+
+        expect_eq(stats.presented, sink.frames.size());
+        for (size_t n = 0; n < sink.frames.size(); ++n) {
+            expect_eq(n == 0 || sink.frames[n] > sink.frames[n - 1], true);
+            expect_eq(sink.pixels[n] == decoded[sink.frames[n]], true);
+        }
+        expect_eq(sink.frames.back(), frames.size() - 1);
+    }
+
+    {
+        // a sink that needs two and a half frames to show one forces drops, the last frame is always shown
+        ss.seekg(0);
+        smk::decoder decoder(ss);
+        recording_sink sink;
+        sink.delay = std::chrono::milliseconds(50);
+        smk::player player(decoder, sink);
+        const auto stats = player.play();
+
+        expect_eq(stats.dropped > 0, true);
+        expect_eq(stats.late > 0, true);
+        expect_eq(stats.presented + stats.dropped, frames.size());
+        expect_eq(sink.frames.back(), frames.size() - 1);
+    }
+
+    {
+        // stopping from inside the sink ends playback after the current frame
+        ss.seekg(0);
+        smk::decoder decoder(ss);
+
+        class stopping_sink : public smk::sink {
+        public:
+            smk::player *player = nullptr;
+            size_t presented = 0;
+
+            void present(size_t, std::span<const uint8_t>, size_t) override {
+                if (++presented == 3) {
+                    player->stop();
+                }
+            }
+        } sink;
+
+        smk::player player(decoder, sink, { .speed = 8 });
+        sink.player = &player;
+        const auto stats = player.play();
+        expect_eq(stats.presented, 3);
+        expect_eq(sink.presented, 3);
+    }
+
+    {
+        ss.seekg(0);
+        smk::decoder decoder(ss);
+        smk::null_sink sink;
+        expect_throw([&] { smk::player(decoder, sink, { .speed = 0 }); });
+    }
+
+    return 0;
+}
@@ -0,0 +1,115 @@
+#include <sstream>
+#include <vector>
+
+#include "util.hpp"
+#include "../lib/smk/service.hpp"
+
+std::string make_video(uint32_t width, uint32_t height, size_t count, size_t seed) {
+    std::stringstream ss(std::ios::in | std::ios::out | std::ios::binary);
+    smk::encoder encoder(width, height, 100);
+    for (size_t n = 0; n < count; ++n) {
+        std::vector<uint8_t> frame(width * height * 3);
+        for (size_t p = 0; p < frame.size(); p += 3) {
+            const size_t color = (p / 3 + n * 7 + seed * 13) % 32;
+            frame[p] = color * 8;
+            frame[p + 1] = 0xFF - color * 8;
+            frame[p + 2] = seed * 0x20;
+        }
+        encoder.encode_frame(frame);
+    }
+    encoder.write(ss);
+    return ss.str();
+}
+
+std::vector<std::vector<uint8_t>> decode_all(const std::string &data) {
+    std::istringstream ss(data, std::ios::binary);
+    smk::decoder decoder(ss);
+    std::vector<std::vector<uint8_t>> frames;
+    for (size_t n = 0; n < decoder.num_frames(); ++n) {
+        const auto frame = decoder.decode_frame();
+        frames.emplace_back(frame.begin(), frame.end());
+    }
+    return frames;
+}
+
+std::unique_ptr<io::input> open_string(const std::string &data) {
+    return std::make_unique<io::stream_input>(std::make_unique<std::istringstream>(data, std::ios::binary));
+}
+
+int main() {
+    const std::vector<std::string> videos = { make_video(32, 16, 9, 0), make_video(16, 16, 5, 1), make_video(48, 32, 7, 2) };
+    std::vector<std::vector<std::vector<uint8_t>>> expected;
+    for (const auto &video : videos) {
+        expected.emplace_back(decode_all(video));
+    }
+
+    {
+        // more streams than workers, frames taken round robin, the smallest budget holds two frames
+        smk::service service({ .threads = 2 });
+        std::vector<smk::service::stream_id> ids;
+        for (size_t n = 0; n < videos.size(); ++n) {
+            ids.push_back(service.open(open_string(videos[n]), { .memory_budget = n == 0 ? size_t(0) : size_t(1024 * 1024) }));
+        }
+        expect_eq(service.width(ids[2]), 48);
+        expect_eq(service.num_frames(ids[1]), 5);
+
+        std::vector<size_t> next(videos.size(), 0);
+        for (bool any = true; any;) {
+            any = false;
+            for (size_t n = 0; n < ids.size(); ++n) {
+                const auto frame = service.acquire(ids[n]);
+                if (!frame) {
+                    expect_eq(next[n], expected[n].size());
+                    continue;
+                }
+                any = true;
+                expect_eq(frame->index, next[n]);
+                expect_eq(frame->stride, service.width(ids[n]) * 3);
+                expect_eq(std::ranges::equal(frame->pixels, expected[n][next[n]]), true);
+                ++next[n];
+            }
+        }
+
+        for (const auto id : ids) {
+            service.close(id);
+        }
+        expect_throw([&] { service.acquire(ids[0]); });
+    }
+
+    {
+        // looping streams keep going, closing one while its next frame is being decoded is fine
+        smk::service service({ .threads = 3 });
+        const auto looped = service.open(open_string(videos[1]), { .loop = true });
+        const auto other = service.open(open_string(videos[0]), { .format = smk::decoder::pixel_format::rgba8888, .loop = true });
+
+        for (size_t n = 0; n < 12; ++n) {
+            const auto frame = service.acquire(looped);
+            expect_eq(frame->index, n % 5);
+            expect_eq(std::ranges::equal(frame->pixels, expected[1][n % 5]), true);
+        }
+
+        expect_eq(service.acquire(other)->stride, 32 * 4);
+        service.close(other);
+        service.close(looped);
+    }
+
+    {
+        // a stream that fails reports it on acquire and leaves the others alone
+        smk::service service({ .threads = 2 });
+        const auto &video = videos[0];
+        const auto broken = service.open(open_string(video.substr(0, video.size() - 40)), {});
+        const auto intact = service.open(open_string(videos[1]), {});
+
+        expect_throw([&] {
+            while (service.acquire(broken)) {
+            }
+        });
+
+        for (size_t n = 0; n < expected[1].size(); ++n) {
+            expect_eq(std::ranges::equal(service.acquire(intact)->pixels, expected[1][n]), true);
+        }
+        expect_eq(service.acquire(intact).has_value(), false);
+    }
+
+    return 0;
+}
@@ -20,19 +20,25 @@
 #include <cstdint>
 #include <span>
 #include <array>
+#include <deque>
+#include <future>
 #include <memory>
 #include <optional>
 #include <limits>
 #include <climits>
 #include <bit>
+#include <chrono>
 #include <sstream>
 #include <cassert>
 
+#include <filesystem>
+#include "../lib/io/input.hpp"
+
 #define private public
 #include "../lib/smk/encoder.hpp"
 #undef private
 
-#define private public: decoder(std::istream &file, bool testing_only) : _file(file) {}; public
+#define private public: decoder(std::istream &file, bool testing_only) : _owned_input(std::make_unique<io::stream_input>(file)), _input(*_owned_input) {}; public
 #include "../lib/smk/decoder.hpp"
 #undef private
 